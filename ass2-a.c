@@ -147,10 +147,11 @@ void print_stage_2(city_t *city)
 			{
 				arr = array_new(1);
 				/* trace backwards from the end, to the start, 
-				 * adding the corners to a list */
+				 * appending the corners to a list, so it is printed from
+				 * the back, without shifting the list on each insert */
 				while (cnr->via)
 				{
-					array_insert(cnr, arr, 0);
+					array_insert(cnr, arr, -1);
 					cnr = cnr->via;
 				}
 				printf("S2: start at grid %s, cost of %d\n", 
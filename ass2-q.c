@@ -1,12 +1,25 @@
 /* Author: James Barnes (barnesj2, 820946) */
 
 /* ~~LIBRARIES~~ */
+#define _POSIX_C_SOURCE 200809L /* getopt, getline, shm_open, clock_gettime */
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
 #include <assert.h>
 #include <math.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 
 /* ~~MACROS~~ */
@@ -18,7 +31,7 @@
 #define WEST        2
 #define SOUTH       3
 #define BORDER_CNR  "+----+"	/* route map (stage 3) strings/lengths */
-#define BORDER_TOP  "--------+"	
+#define BORDER_TOP  "--------+"
 #define BORDER_SIDE " | "
 #define ARROW_WEST  " <<<<"
 #define ARROW_EAST  " >>>>"
@@ -27,438 +40,4675 @@
 #define ARROW_NORTH "   ^"
 #define BLANK_LON   "    "
 #define LON_LEN     2
+#define BUCKETS     (MAX_SECS + 1)  /* circular buckets for dial's queue */
+#define ENGINE_QUEUE 0          /* find_paths backends */
+#define ENGINE_DIAL  1
+#define NO_CNR      UINT32_MAX  /* corner index for "no corner" */
+#define NAME_LEN    16          /* space for a printed corner name */
+#define HALT        CARD_DIRS   /* state of a start, not arrived from a dir */
+#define STATES      (CARD_DIRS + 1) /* states of a corner, expanded search */
+#define DIR_CHARS   "ENWS"      /* directions, as named in a turns file */
+#define DAY_SECS    86400
+#define WITNESS_MAX 500         /* corners a witness search may settle */
+#define FIELD_RUN   32          /* corners to a run of packed costs */
+#define VARINT_MAX  5           /* bytes in the longest varint of an int */
+#define LCG_MUL     1103515245u /* a full period lcg mod any power of two, */
+#define LCG_INC     12345u      /* for lookups in a fixed shuffled order */
+#define PIPE_LEN    16          /* queries a pipe between stages can hold */
+#define PIPE_SPINS  64          /* yields before a stage sleeps on a pipe */
+#define CACHE_LINE  64          /* bytes, to keep the ends of a pipe apart */
+#define STAGES      3           /* of the query pipeline */
+#define HIST_BUCKETS 32         /* powers of two of microseconds */
+#define STAT_BINS   10          /* of the histogram of street times */
+#define STAT_WIDTH  100         /* secs in each of those bins */
+#define STAT_COUNTS 4           /* counts kept in vectors, before the bins */
+#define STAT_BLOCK  (1 << 18)   /* steps of four corners, before adding up */
 
 
 /* ~~TYPEDEFS~~ */
 typedef struct node_t  node_t;
+typedef struct tree_t  tree_t;
 typedef struct edge_t  edge_t;
 typedef struct city_t  city_t;
-typedef struct list_t  list_t;
 typedef struct queue_t queue_t;
 typedef struct elem_t  elem_t;
+typedef struct vec_t   vec_t;
+typedef struct opts_t  opts_t;
+typedef struct traffic_t traffic_t;
+typedef struct ch_t    ch_t;
+typedef struct chq_t   chq_t;
+typedef struct elist_t elist_t;
+typedef struct heap_t  heap_t;
+typedef struct chb_t   chb_t;
+typedef struct overlay_t overlay_t;
+typedef struct pager_t pager_t;
+typedef struct load_t  load_t;
+typedef struct cache_t cache_t;
+typedef struct field_t field_t;
+typedef struct query_t query_t;
+typedef struct pipe_t  pipe_t;
+typedef struct hist_t  hist_t;
+typedef struct server_t server_t;
+typedef struct stats_t stats_t;
 
 
 /* ~~FUNCTION PROTOTYPES~~ */
-void     print_stage_1(city_t*);
-void     print_stage_2(city_t*);
-void     print_stage_3(city_t*);
-city_t*  read_city_data();
-int 	 dir_offset(int, int);
-void     find_paths(list_t*, list_t*);
-list_t* new_list(size_t);
-list_t* list_insert(void*, list_t*, int);
-void*    list_remove(int, list_t*);
-void     clear_list(list_t*);
-queue_t* new_queue();
-queue_t* enqueue(void*, queue_t*);
-void*    dequeue(queue_t*);
-void     clear_queue(queue_t*);
-void*    safe_malloc(size_t);
-void*    safe_realloc(void*, size_t);
+void      print_stage_1(city_t*, vec_t*);
+void      print_stage_2(city_t*, vec_t*, tree_t*, opts_t*);
+void      print_stage_3(city_t*, vec_t*, tree_t*, opts_t*);
+void      find_routes(city_t*, vec_t*, tree_t*, opts_t*, vec_t*);
+void      print_routes(city_t*, vec_t*);
+field_t*  find_map(city_t*, vec_t*, tree_t*, opts_t*);
+void      print_map(field_t*);
+void      fit_region(city_t*, int*);
+int       in_region(city_t*, int*, uint32_t);
+void      serve_queries(city_t*, tree_t*, opts_t*);
+query_t*  parse_query(city_t*, char*);
+void*     solve_queries(void*);
+void*     render_queries(void*);
+void      free_query(query_t*);
+void      bench_paths(city_t*, vec_t*, tree_t*, opts_t*);
+void      bench_region(city_t*, vec_t*, tree_t*, int*, int, int*, uint32_t*);
+void      bench_cache(city_t*, vec_t*, tree_t*, opts_t*, int*, uint32_t*);
+void      bench_field(city_t*, tree_t*, int, int*, uint32_t*);
+void      bench_ch(city_t*, vec_t*, tree_t*, ch_t*, int);
+void      bench_compare(city_t*, int*, int*, uint32_t*, int*, uint32_t*,
+	char*);
+void      bench_overlay(city_t*, vec_t*, tree_t*, overlay_t*, int, int*,
+                        uint32_t*);
+city_t*   read_city_data();
+void      read_cnrs(city_t*, node_t*, pager_t*);
+void      read_locs(city_t*, vec_t*);
+city_t*   read_city_parallel(int);
+city_t*   parse_city(char*, char*, int);
+void*     load_count(void*);
+void*     load_cnrs(void*);
+char*     next_token(char*, char*, char**);
+int       token_int(char*, char*);
+uint32_t  token_cnr(city_t*, char*, char*);
+void      bench_load(int, int);
+void      bench_stats(city_t*, int);
+city_t*   read_city_file(char*, ch_t**);
+void      write_city_file(city_t*, ch_t*, char*);
+city_t*   read_city_paged(char*, opts_t*);
+city_t*   write_city_paged(char*, opts_t*);
+void      read_paged_locs(city_t*, pager_t*, vec_t*);
+node_t*   city_cnrs(city_t*);
+uint32_t* city_locs(city_t*);
+size_t    city_size(city_t*);
+void      publish_city(city_t*, char*);
+city_t*   attach_city(char*);
+char*     cnr_name(city_t*, uint32_t, char*);
+uint32_t  cnr_index(city_t*, char*);
+int       set_street(city_t*, uint32_t, int, int);
+int 	  dir_offset(int, int);
+uint32_t  neighbour(city_t*, uint32_t, int);
+void      find_paths(city_t*, uint32_t*, int, opts_t*, tree_t*);
+void      find_paths_queue(city_t*, uint32_t*, int, tree_t*);
+void      find_paths_dial(city_t*, pager_t*, int*, uint32_t*, int, tree_t*);
+void      find_paths_expanded(city_t*, uint32_t*, int, traffic_t*, tree_t*);
+void      find_paths_overlay(city_t*, overlay_t*, uint32_t*, int, tree_t*);
+int       relax(city_t*, tree_t*, uint32_t, edge_t*);
+int       lex_lower(city_t*, uint32_t, uint32_t);
+uint32_t  cost_via(city_t*, int*, uint32_t);
+int       better_via(city_t*, tree_t*, uint32_t, uint32_t);
+int       lower_via(city_t*, tree_t*, uint32_t, uint32_t);
+uint32_t  best_label(city_t*, tree_t*, uint32_t);
+int       tree_cost(city_t*, tree_t*, uint32_t);
+uint32_t  tree_via(city_t*, tree_t*, uint32_t);
+traffic_t* read_traffic(city_t*, opts_t*);
+void      free_traffic(traffic_t*);
+int       turn_secs(traffic_t*, uint32_t, int, int);
+int       street_secs(traffic_t*, int, int);
+int       trace_path(city_t*, tree_t*, uint32_t, uint32_t*, int);
+int       turns_only(city_t*, uint32_t*, int, int);
+int       is_turn(city_t*, uint32_t, uint32_t, uint32_t);
+ch_t*     build_ch(city_t*);
+int       contract(chb_t*, uint32_t, int);
+uint32_t* ch_first(ch_t*, int);
+edge_t*   ch_edges(ch_t*, int);
+uint32_t* ch_mids(ch_t*, int);
+size_t    ch_size(ch_t*);
+chq_t*    new_chq(ch_t*, vec_t*);
+void      free_chq(chq_t*);
+void      ch_source(ch_t*, chq_t*, uint32_t);
+int       ch_cost(ch_t*, chq_t*, uint32_t);
+int       ch_search(ch_t*, chq_t*, int, uint32_t, int);
+int       ch_path(city_t*, ch_t*, chq_t*, uint32_t, tree_t*, uint32_t*, int);
+int       ch_route(ch_t*, chq_t*, uint32_t, uint32_t*, int, int*);
+int       ch_route_up(ch_t*, chq_t*, uint32_t, uint32_t*, int, int, int*);
+int       ch_unpack(ch_t*, uint32_t, uint32_t, uint32_t*, int, int, int*);
+overlay_t* build_overlay(city_t*, int);
+void      free_overlay(overlay_t*);
+size_t    overlay_size(city_t*, overlay_t*);
+uint32_t  ov_block(city_t*, overlay_t*, uint32_t);
+void      ov_box(city_t*, overlay_t*, uint32_t, int*);
+int       ov_lower(overlay_t*, int*, uint32_t, int);
+void      ov_local(city_t*, overlay_t*, uint32_t, int*);
+void      ov_refine(city_t*, overlay_t*, tree_t*, uint32_t);
+int       ov_is_start(overlay_t*, uint32_t);
+void      ov_route(city_t*, overlay_t*, tree_t*, uint32_t);
+void      ov_settle_all(city_t*, overlay_t*, tree_t*);
+pager_t*  new_pager(FILE*, city_t*, opts_t*);
+void      free_pager(pager_t*);
+node_t*   pager_cnr(pager_t*, uint32_t, int);
+void      pager_io(pager_t*, int, int);
+void      pager_flush(pager_t*);
+void      print_pager(pager_t*, FILE*);
+cache_t*  new_cache(int);
+void      free_cache(cache_t*);
+int       cache_key(uint32_t*, int, uint32_t*);
+int       cmp_cnr(const void*, const void*);
+int       cache_find(cache_t*, city_t*, uint32_t*, int, tree_t*);
+void      cache_add(cache_t*, city_t*, uint32_t*, int, tree_t*);
+void      print_cache(cache_t*, FILE*);
+field_t*  pack_field(city_t*, tree_t*, int*);
+void      unpack_field(field_t*, tree_t*);
+size_t    field_size(field_t*);
+uint32_t* field_none(field_t*);
+uint32_t* field_runs(field_t*);
+unsigned char* field_dirs(field_t*);
+unsigned char* field_bytes(field_t*);
+uint32_t  field_local(field_t*, uint32_t);
+int       field_cost(field_t*, uint32_t);
+void      field_decode(field_t*, uint32_t, int, int*);
+uint32_t  field_via(field_t*, uint32_t);
+void      new_pipe(pipe_t*);
+void      free_pipe(pipe_t*);
+void      pipe_push(pipe_t*, query_t*);
+query_t*  pipe_pop(pipe_t*);
+void      pipe_wait(pipe_t*, atomic_ulong*, unsigned long, int);
+void      pipe_wake(pipe_t*);
+void      hist_add(hist_t*, double);
+void      print_hist(hist_t*, char*, FILE*);
+double    now_secs();
+void      city_stats(city_t*, stats_t*);
+void      clear_stats(stats_t*);
+void      stats_cnr(city_t*, uint32_t, stats_t*);
+void      stats_pair(int, int, stats_t*);
+void      stats_border(city_t*, stats_t*);
+void      city_stats_scalar(city_t*, stats_t*);
+#ifdef __SSE2__
+void      load_times(node_t*, __m128i*);
+void      pairs_sse2(__m128i, __m128i, __m128i, __m128i*, __m128i*);
+void      city_stats_sse2(city_t*, stats_t*);
+void      stats_lanes(__m128i*, stats_t*, long*);
+#endif
+void      print_stats(city_t*, stats_t*, FILE*);
+queue_t*  new_queue();
+queue_t*  enqueue(uint32_t, queue_t*);
+uint32_t  dequeue(queue_t*);
+void      clear_queue(queue_t*);
+void      vec_push(uint32_t, vec_t*);
+void      clear_vec(vec_t*);
+vec_t*    new_buckets();
+void      free_buckets(vec_t*);
+void      elist_add(uint32_t, int, uint32_t, elist_t*);
+void      elist_remove(uint32_t, elist_t*);
+void      heap_push(uint32_t, int, heap_t*);
+uint32_t  heap_pop(heap_t*, int*);
+tree_t*   new_tree(uint32_t, int);
+void      free_tree(tree_t*);
+void*     safe_malloc(size_t);
+void*     safe_realloc(void*, size_t);
 
 
 /* ~~STRUCTS~~ */
+/* a city is a single block of memory holding no pointers, so it can be
+   moved, written out or shared as is. the header is followed by the
+   n_cnrs corners, indexed by x + y * x_dim, then by the n_locs indices of
+   the taxi locations. use city_cnrs and city_locs to find them.
+   a city is only read once built, so may be shared between processes,
+   other than by set_street, which bumps its version */
 struct city_t
 {
-	list_t *cnrs;  /* corners (intersections) in the city */
-	list_t *locs;  /* locations of taxis in the city */
 	int x_dim, y_dim, total_secs, unusable;
+	uint32_t n_cnrs, n_locs;
+	uint32_t version;   /* changes whenever a street does, so paths found
+	                       on the city can tell they are out of date */
+};
+
+/* a street leaving a corner. to is NO_CNR if the street can't be used */
+struct edge_t
+{
+	uint32_t to;
+	int weight;
 };
 
 struct node_t
 {
-	char *name;
-	int x, y;
-	list_t *out;    /* outgoing edges of node */
-	node_t *via;    /* previous node in the path to the node */
-	int cost;       /* net cost of the path to node */
+	edge_t out[CARD_DIRS];  /* outgoing streets of node, by direction */
 };
 
-struct edge_t
+/* the paths found by find_paths, kept apart from the city so that each
+   query has its own. paths are to labels: a label is a corner when
+   states is 1, else label / states is the corner and label % states the
+   direction it was arrived in (or HALT). use tree_cost and tree_via for
+   the best path to a corner */
+struct tree_t
 {
-	node_t *to, *from;
-	int weight;
+	uint32_t *via;  /* previous label in the path to each label */
+	int *cost;      /* net cost of the path to each label */
+	int states;     /* labels per corner in the last search */
+	vec_t *buckets; /* dial's queue, left empty by each search, so it is
+	                   only grown once for all of them */
+};
+
+/* turn costs and time of day street times, for the expanded search */
+struct traffic_t
+{
+	short *turns;   /* secs to turn at each corner, by the direction it was
+	                   arrived in then left in, CARD_DIRS^2 per corner.
+	                   NULL if turns are free */
+	int n_periods;
+	int *start;     /* secs into the day each period starts, ascending */
+	int *pct;       /* percentage of its time a street takes in a period */
+	int depart;     /* secs into the day taxis leave their locations */
+};
+
+struct queue_t
+{
+	elem_t *first, *last;
+	size_t len;
+};
+
+struct elem_t
+{
+	uint32_t data;
+	elem_t *prev, *next;
+};
+
+/* growable contiguous array of corner indices, used for the buckets of
+   dial's queue so that pushing a corner doesn't cost a malloc */
+struct vec_t
+{
+	uint32_t *items;
+	int len;
+	size_t size;
+};
+
+/* a contraction hierarchy of a city (Geisberger et al, 2008). corners are
+   contracted one at a time, adding shortcut streets between their
+   remaining neighbours where needed to keep their costs, so a query only
+   searches upwards, towards later contracted corners, from each end.
+   like a city, it is a single block. the header is followed by the first
+   up and first down edge of each corner (n_cnrs + 1 offsets each), then
+   the up edges: streets or shortcuts to later corners, then the down
+   edges: streets or shortcuts from later corners, with to as the later
+   corner, then the corner each up and down edge skips, if a shortcut, or
+   NO_CNR. use ch_first, ch_edges and ch_mids to find them */
+struct ch_t
+{
+	uint32_t n_cnrs, n_up, n_down;
+};
+
+/* scratch for contraction hierarchy queries from a source. entries of
+   fwd, bwd and cost are only valid if their _at entry is the id of the
+   current search, so they never need to be cleared */
+struct chq_t
+{
+	uint32_t source;
+	int *fwd, *bwd; /* costs in the forward search from source, and in the
+	                   backward search to the last corner asked for */
+	int *cost;      /* costs of corners from source, as they are found */
+	uint32_t *fwd_at, *bwd_at, *cost_at;
+	uint32_t *fwd_via, *bwd_via;    /* corner each was reached from */
+	uint32_t fwd_id, bwd_id;
+	uint32_t meet;  /* where the last backward search met the forward one */
+	vec_t *buckets; /* dial's queue for the searches, of the tree it was
+	                   made with */
+};
+
+/* binary min-heap of corner indices by key */
+struct heap_t
+{
+	uint32_t *items;
+	int *keys;
+	int len;
+	size_t size;
+};
+
+/* a contraction hierarchy being built: the streets and shortcuts into and
+   out of each corner, which are contracted (done), and scratch for
+   witness searches */
+struct chb_t
+{
+	elist_t *out, *in;
+	char *done;
+	int *depth;     /* contracted neighbours of each corner */
+	int *dist;      /* cost of each corner in the witness search, only
+	                   valid if seen by it */
+	uint32_t *seen, search_id;
+	heap_t search;
+};
+
+/* an overlay of a city, split into square blocks of side corners. the
+   boundary corners of a block have streets to or from other blocks, and
+   the cost from each to each other, within the block, is kept. searching
+   these and the streets between blocks finds the costs of all boundary
+   corners, then blocks are refined, searched inside from those costs, only
+   when their corners are needed */
+struct overlay_t
+{
+	int side, x_blocks, y_blocks;
+	uint32_t *first;    /* first boundary corner of each block in bnd, and
+	                       the number of boundary corners at the end */
+	uint32_t *bnd;      /* boundary corners, by block */
+	uint32_t *slot;     /* index of each corner in its block's part of bnd,
+	                       or NO_CNR if not a boundary corner */
+	uint32_t *first_cost; /* first entry of each block in cost */
+	short *cost;        /* a k by k matrix for each block of k boundary
+	                       corners, by from then to, MAX_SECS if no route */
+	char *refined;      /* whether each block's corners are settled */
+	uint32_t *starts;   /* of the last search */
+	int n_starts;
+	vec_t *buckets;     /* dial's queue for all of its searches */
+};
+
+/* a cache of the corners of a binary city file, in bands of rows (or runs
+   of corners), for cities too big to hold. bands are read into frames as they
+   are needed, evicting the least recently used, and written back first if
+   changed */
+struct pager_t
+{
+	FILE *fp;
+	uint32_t n_cnrs;
+	uint32_t band_cnrs; /* corners in a band, the last may have fewer */
+	int n_bands, n_frames, used;
+	node_t *frames;     /* n_frames bands of corners */
+	int *band_of;       /* band in each frame, or -1 */
+	int *frame_of;      /* frame of each band, or -1 if not resident */
+	char *dirty;        /* whether each frame has changed since read */
+	int *newer, *older; /* the frames as a list by last use, -1 ends it */
+	int newest, oldest;
+	long hits, faults, evictions;
+	unsigned long bytes_read, bytes_written;
+};
+
+/* a chunk of a mapped city for one thread of parse_city to load */
+struct load_t
+{
+	char *start, *end;  /* the chunk, which starts a line */
+	char *map_end;      /* a corner's last times may run past end */
+	city_t *city;
+	uint32_t first_cnr, last_cnr; /* corners to initialise */
+	long first_token, tokens; /* tokens before and in the chunk */
+	int total_secs, unusable; /* of the corners in the chunk */
+	vec_t locs;         /* locations in the chunk */
+};
+
+/* a bounded cache of the paths found from sets of starts, so a set asked
+   for again is looked up rather than searched. entries are keyed by their
+   starts, sorted and without repeats, as the paths don't depend on their
+   order, and only hold for the version of the city they were found on.
+   when full, the least recently used entry is replaced */
+struct cache_t
+{
+	int n_slots, used;
+	uint32_t version;   /* of the city the entries were found on */
+	uint32_t **key;     /* starts of each entry */
+	int *key_len;
+	field_t **field;    /* paths of each entry, over the whole city */
+	long *last_use, uses;
+	long hits, misses, evictions;
+	unsigned long bytes;    /* held by the entries */
+};
+
+/* the costs and vias of the paths to a rectangle of corners, packed. a
+   via is always a neighbour, so is kept as its direction in 2 bits, but
+   for the few corners without one, a start or a corner with no route,
+   which are listed. costs are kept as the difference from the corner
+   before, which is small, in a zigzag varint: 7 bits to a byte, the top
+   bit set if more follow. the first of each run of FIELD_RUN corners is
+   kept as is, and the offset of each run is kept, so any cost can be
+   found by decoding only part of a run.
+   like a city, it is a single block, which may be written out as is. the
+   header is followed by the sorted corners without a via, then the offset
+   of each run in the packed costs (n_runs + 1 offsets), then the
+   directions, four to a byte, then the packed costs. corners are indexed
+   within the rectangle, by row. use field_none, field_runs, field_dirs and
+   field_bytes to find them */
+struct field_t
+{
+	int x_dim;          /* of the city */
+	int box[4];         /* corners held, as x0, y0, x1, y1 */
+	uint32_t n_cnrs, n_none, n_runs, n_bytes;
+};
+
+/* a query on its way through serve_queries: read by the parse stage,
+   answered by the solve stage and printed by the render stage */
+struct query_t
+{
+	vec_t locs;
+	uint32_t cnr;       /* the street from cnr in dir to change to secs, or
+	                       NO_CNR if this is a query of locs */
+	int dir, secs;
+	city_t head;        /* header of the city when solved, for stage 1 */
+	vec_t routes;       /* stage 2, from find_routes */
+	field_t *field;     /* stage 3, from find_map */
+	double read;        /* when it was read, in secs */
+};
+
+/* a bounded queue of queries from one stage to the next. neither end takes
+   a lock to push or pop: each only writes its own index, on its own cache
+   line, once its query is written or read, so the other end sees that. a
+   stage waits on a full or empty pipe by yielding a few times, then sleeps
+   on wake until the other end moves. NULL ends the stream */
+struct pipe_t
+{
+	atomic_ulong head;          /* popped from here */
+	char head_pad[CACHE_LINE - sizeof(atomic_ulong)];
+	atomic_ulong tail;          /* and pushed here */
+	char tail_pad[CACHE_LINE - sizeof(atomic_ulong)];
+	query_t *items[PIPE_LEN];
+	atomic_int waiting;         /* ends asleep on wake */
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+};
+
+/* latencies, counted by the power of two of microseconds above them */
+struct hist_t
+{
+	long count[HIST_BUCKETS];
+	long n;
+	double total, max;  /* in secs */
+};
+
+/* the stages of serve_queries and the pipes between them */
+struct server_t
+{
+	city_t *city;
+	tree_t *tree;
+	opts_t *opts;
+	pipe_t to_solve, to_render;
+	hist_t hist[STAGES + 1];    /* of each stage, then from read to printed */
+};
+
+/* statistics of the streets of a city, to check it by */
+struct stats_t
+{
+	long total_secs, unusable;  /* as the city should have them */
+	int min, max;       /* usable times, or MAX_SECS and -1 if none */
+	long hist[STAT_BINS];   /* usable times, STAT_WIDTH secs to a bin */
+	long one_way;       /* streets that can be used one way only */
+	long uneven;        /* two way streets that take longer one way */
+	long off_grid;      /* usable streets off the edge of the grid */
+};
+
+/* growable array of streets, for the changing graph while contracting */
+struct elist_t
+{
+	edge_t *items;
+	uint32_t *mids; /* the corner each shortcut skips, or NO_CNR */
+	int len;
+	size_t size;
+};
+
+/* command line options */
+struct opts_t
+{
+	int engine;     /* find_paths backend, ENGINE_QUEUE or ENGINE_DIAL */
+	int bench_runs; /* if > 0, benchmark the engines instead of printing */
+	int turns;      /* only report the corners where stage 2 routes turn */
+	char *publish;  /* shared memory name to publish the city under */
+	char *attach;   /* shared memory name of a city to use */
+	char *turns_file;   /* file of turn costs */
+	char *profile_file; /* file of time of day periods */
+	int depart;     /* secs into the day taxis leave */
+	traffic_t *traffic; /* read from the above, NULL for static times */
+	int build_ch;   /* build a contraction hierarchy for stage 2 */
+	char *input;    /* binary city file to read the city from */
+	char *output;   /* binary city file to write the city to */
+	ch_t *ch;       /* built or read with the city, NULL if neither */
+	int block;      /* side of the overlay's blocks, 0 for no overlay */
+	overlay_t *overlay; /* built from the above */
+	int pages;      /* bands of a binary city file to cache, 0 to read all
+	                   of it */
+	int band_rows;  /* rows in each of those bands */
+	int band_cnrs;  /* or if set, corners in each, as runs of a row are
+	                   kinder to a search's frontier in a wide city */
+	pager_t *pager; /* of the binary city file, if paged */
+	int threads;    /* to parse the city with, 0 to read it with scanf */
+	int *region;    /* corners stage 3 maps, as x0, y0, x1, y1, or NULL
+	                   for the whole city. find_paths may stop once they
+	                   are settled */
+	int region_box[4];  /* what region points to, if set */
+	int cache_slots;    /* if > 0, answer queries from stdin, caching the
+	                       paths from this many sets of locations */
+	cache_t *cache;     /* of the above, NULL for none */
+	int validate;       /* check the city's streets as it is read */
 };
 
-/* basically an augmented array, which is more user-friendly, allowing for
-   resizing on insertion, and storage of the length, etc. */
-struct list_t
+
+/* ~~FUNCTIONS~~ */
+int main(int argc, char *argv[])
+{
+	int opt;
+	char y0, y1;
+	stats_t stats;
+	city_t *city;
+	tree_t *tree;
+	vec_t locs = {NULL, 0, 0};
+	opts_t opts = {.engine = ENGINE_QUEUE, .band_rows = 1};
+
+	while ((opt = getopt(argc, argv,
+		"e:b:tp:a:u:T:P:s:Ci:o:B:M:R:W:j:r:q:v")) != -1)
+	{
+		if (opt == 'e' && !strcmp(optarg, "queue"))
+		{
+			opts.engine = ENGINE_QUEUE;
+		}
+		else if (opt == 'e' && !strcmp(optarg, "dial"))
+		{
+			opts.engine = ENGINE_DIAL;
+		}
+		else if (opt == 'b' && (opts.bench_runs = atoi(optarg)) > 0)
+		{
+			continue;
+		}
+		else if (opt == 't')
+		{
+			opts.turns = 1;
+		}
+		else if (opt == 'p')
+		{
+			opts.publish = optarg;
+		}
+		else if (opt == 'a')
+		{
+			opts.attach = optarg;
+		}
+		else if (opt == 'T')
+		{
+			opts.turns_file = optarg;
+		}
+		else if (opt == 'P')
+		{
+			opts.profile_file = optarg;
+		}
+		else if (opt == 's' && (opts.depart = atoi(optarg)) >= 0)
+		{
+			opts.depart %= DAY_SECS;
+		}
+		else if (opt == 'C')
+		{
+			opts.build_ch = 1;
+		}
+		else if (opt == 'B' && (opts.block = atoi(optarg)) > 0)
+		{
+			/* blocks of block by block corners */
+		}
+		else if (opt == 'M' && (opts.pages = atoi(optarg)) > 0)
+		{
+			/* cache this many bands of the city file */
+		}
+		else if (opt == 'R' && (opts.band_rows = atoi(optarg)) > 0)
+		{
+			/* of this many rows each */
+		}
+		else if (opt == 'W' && (opts.band_cnrs = atoi(optarg)) > 0)
+		{
+			/* or this many corners each */
+		}
+		else if (opt == 'j' && (opts.threads = atoi(optarg)) > 0)
+		{
+			/* parse the city with this many threads */
+		}
+		else if (opt == 'r' && sscanf(optarg, "%d%c:%d%c",
+			&opts.region_box[0], &y0, &opts.region_box[2], &y1) == 4)
+		{
+			/* a rectangle of corners, by opposite ones, eg. 3b:10f */
+			opts.region_box[1] = y0 - 'a';
+			opts.region_box[3] = y1 - 'a';
+			opts.region = opts.region_box;
+		}
+		else if (opt == 'q' && (opts.cache_slots = atoi(optarg)) > 0)
+		{
+			/* answer queries, caching this many of their results */
+		}
+		else if (opt == 'v')
+		{
+			opts.validate = 1;
+		}
+		else if (opt == 'i')
+		{
+			opts.input = optarg;
+		}
+		else if (opt == 'o')
+		{
+			opts.output = optarg;
+		}
+		else if (opt == 'u')
+		{
+			/* remove a published city, processes using it keep their map */
+			exit(shm_unlink(optarg) ? EXIT_FAILURE : EXIT_SUCCESS);
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [-e queue|dial] [-b runs] [-t] "
+				"[-p name | -a name | -u name] [-T turns] [-P profile] "
+				"[-s depart] [-C] [-i city.bin] [-o city.bin] [-B block] "
+				"[-M pages] [-R rows | -W cnrs] [-j threads] "
+				"[-r cnr:cnr] [-q slots] [-v]\n", argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (opts.pages && (!opts.input == !opts.output || opts.publish ||
+		opts.attach || opts.build_ch || opts.block || opts.turns_file ||
+		opts.profile_file || opts.validate))
+	{
+		/* only static routes are paged, the rest need the whole city */
+		fprintf(stderr, "%s: -M needs one of -i or -o, and no -p, -a, -C, "
+			"-B, -T, -P or -v\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if (opts.cache_slots && (!opts.input == !opts.attach || opts.output ||
+		opts.publish))
+	{
+		/* stdin holds the queries, so the city must come from elsewhere */
+		fprintf(stderr, "%s: -q needs one of -i or -a, and no -o or -p\n",
+			argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	if (opts.attach || opts.input)
+	{
+		/* use a published or binary city, with the locations from stdin,
+		   or else the ones it was saved with. stdin may hold queries */
+		city = opts.attach ? attach_city(opts.attach) :
+		       opts.pages  ? read_city_paged(opts.input, &opts) :
+		                     read_city_file(opts.input, &opts.ch);
+		if (!opts.cache_slots)
+		{
+			read_locs(city, &locs);
+		}
+		if (!locs.len && opts.pager)
+		{
+			read_paged_locs(city, opts.pager, &locs);
+		}
+		else if (!locs.len)
+		{
+			clear_vec(&locs);
+			locs.items = city_locs(city);
+			locs.len = city->n_locs;
+		}
+	}
+	else if (opts.pages)
+	{
+		/* convert the city from stdin to the file a band at a time,
+		   without ever holding all of it */
+		city = write_city_paged(opts.output, &opts);
+	}
+	else
+	{
+		/* read data from stdin */
+		city = opts.threads ? read_city_parallel(opts.threads) :
+		                      read_city_data();
+		locs.items = city_locs(city);
+		locs.len = city->n_locs;
+	}
+	if (opts.validate)
+	{
+		city_stats(city, &stats);
+		print_stats(city, &stats, stderr);
+	}
+	if (opts.build_ch)
+	{
+		free(opts.ch);
+		opts.ch = build_ch(city);
+	}
+	if (opts.publish || opts.output)
+	{
+		/* save the city for other processes, rather than using it */
+		if (opts.publish)
+		{
+			publish_city(city, opts.publish);
+		}
+		if (opts.output && !opts.pager)
+		{
+			write_city_file(city, opts.ch, opts.output);
+		}
+	}
+	else
+	{
+		opts.traffic = read_traffic(city, &opts);
+		if (opts.region)
+		{
+			fit_region(city, opts.region);
+		}
+		tree = new_tree(city->n_cnrs, opts.traffic ? STATES : 1);
+		if (opts.block)
+		{
+			opts.overlay = build_overlay(city, opts.block);
+		}
+		if (opts.cache_slots)
+		{
+			opts.cache = new_cache(opts.cache_slots);
+		}
+
+		if (opts.bench_runs)
+		{
+			if (opts.threads && !opts.input && !opts.attach)
+			{
+				bench_load(opts.threads, opts.bench_runs);
+			}
+			if (!opts.pager)
+			{
+				bench_stats(city, opts.bench_runs);
+			}
+			bench_paths(city, &locs, tree, &opts);
+		}
+		else if (opts.cache)
+		{
+			serve_queries(city, tree, &opts);
+		}
+		else
+		{
+			print_stage_1(city, &locs);
+			print_stage_2(city, &locs, tree, &opts);
+			print_stage_3(city, &locs, tree, &opts);
+		}
+
+		free_tree(tree);
+		tree = NULL;
+		if (opts.overlay)
+		{
+			free_overlay(opts.overlay);
+			opts.overlay = NULL;
+		}
+		if (opts.traffic)
+		{
+			free_traffic(opts.traffic);
+			opts.traffic = NULL;
+		}
+		if (opts.cache)
+		{
+			print_cache(opts.cache, stderr);
+			free_cache(opts.cache);
+			opts.cache = NULL;
+		}
+	}
+
+	free(opts.ch);
+	opts.ch = NULL;
+	if (opts.pager)
+	{
+		print_pager(opts.pager, stderr);
+		free_pager(opts.pager);
+		opts.pager = NULL;
+	}
+	/* locs only owns its items if they were read from stdin */
+	if (locs.size)
+	{
+		clear_vec(&locs);
+	}
+	if (opts.attach)
+	{
+		munmap(city, city_size(city));
+	}
+	else
+	{
+		/* the city is a single block */
+		free(city);
+	}
+	city = NULL;
+
+	return 0;
+}
+
+void print_stage_1(city_t *city, vec_t *locs)
+{
+	char first[NAME_LEN], last[NAME_LEN];
+
+	printf("S1: grid is %d x %d, and has %d intersections\n",
+		city->x_dim, city->y_dim, city->n_cnrs);
+	printf("S1: of %d possibilities, %d of them cannot be used\n",
+		CARD_DIRS * city->n_cnrs, city->unusable);
+	printf("S1: total cost of remaining possibilities is %d seconds\n",
+		city->total_secs);
+	printf("S1: %d grid locations supplied",
+		locs->len);
+	if (locs->len)
+	{
+		printf(", first one is %s, last one is %s",
+			cnr_name(city, locs->items[0], first),
+			cnr_name(city, locs->items[locs->len - 1], last));
+	}
+	printf("\n\n");
+}
+
+void print_stage_2(city_t *city, vec_t *locs, tree_t *tree, opts_t *opts)
+{
+	vec_t routes = {NULL, 0, 0};
+
+	find_routes(city, locs, tree, opts, &routes);
+	print_routes(city, &routes);
+	clear_vec(&routes);
+}
+
+/* find the routes from the first location to each other location, and add
+   them to routes, each as its length, then its corners and their costs */
+void find_routes(city_t *city, vec_t *locs, tree_t *tree, opts_t *opts,
+	vec_t *routes)
+{
+	int i, j, len;
+	uint32_t *path;
+	chq_t *chq = NULL;
+	/* routes may leave the stage 3 region */
+	opts_t route_opts = *opts;
+
+	route_opts.region = NULL;
+	if (!locs->len)
+	{
+		return;
+	}
+
+	/* find the paths from the first location and each other location.
+	   a contraction hierarchy only finds those to the other locations */
+	if (opts->ch && !opts->traffic)
+	{
+		chq = new_chq(opts->ch, tree->buckets);
+		ch_source(opts->ch, chq, locs->items[0]);
+		tree->states = 1;
+	}
+	else
+	{
+		find_paths(city, locs->items, 1, &route_opts, tree);
+	}
+
+	/* a route can't be longer than the number of labels */
+	path = safe_malloc(city->n_cnrs * tree->states * sizeof(uint32_t));
+	for (i = 1; i < locs->len; i++)
+	{
+		if (!chq && opts->overlay && !opts->traffic)
+		{
+			/* settle the blocks the route passes through */
+			ov_route(city, opts->overlay, tree, locs->items[i]);
+		}
+		len = chq ?
+			ch_path(city, opts->ch, chq, locs->items[i], tree, path, opts->turns) :
+			trace_path(city, tree, locs->items[i], path, opts->turns);
+		vec_push(len, routes);
+		for (j = 0; j < len; j++)
+		{
+			vec_push(path[j] / tree->states, routes);
+			vec_push(tree->cost[path[j]], routes);
+		}
+	}
+	free(path);
+	path = NULL;
+	if (chq)
+	{
+		free_chq(chq);
+		chq = NULL;
+	}
+}
+
+/* print the routes found by find_routes */
+void print_routes(city_t *city, vec_t *routes)
+{
+	int i, j, len;
+	char name[NAME_LEN];
+	uint32_t *route;
+
+	for (i = 0; i < routes->len; i += 1 + 2 * len)
+	{
+		len = routes->items[i];
+		route = routes->items + i + 1;
+		for (j = 0; j < len; j++)
+		{
+			if (!j)
+			{
+				printf("S2: start at grid %s, cost of %d\n",
+					cnr_name(city, route[0], name), (int)route[1]);
+			}
+			else
+			{
+				printf("S2:       then to %s, cost of %d\n",
+					cnr_name(city, route[2 * j], name), (int)route[2 * j + 1]);
+			}
+		}
+	}
+}
+
+void print_stage_3(city_t *city, vec_t *locs, tree_t *tree, opts_t *opts)
+{
+	field_t *field = find_map(city, locs, tree, opts);
+
+	print_map(field);
+	free(field);
+	field = NULL;
+}
+
+/* find the shortest route to each corner via one of the locations, or at
+   least those in the region, and return them packed for print_map */
+field_t* find_map(city_t *city, vec_t *locs, tree_t *tree, opts_t *opts)
+{
+	int whole[4] = {0, 0, city->x_dim - 1, city->y_dim - 1};
+
+	find_paths(city, locs->items, locs->len, opts, tree);
+	if (opts->overlay && !opts->traffic)
+	{
+		ov_settle_all(city, opts->overlay, tree);
+	}
+	return pack_field(city, tree, opts->region ? opts->region : whole);
+}
+
+/* draw the stage 3 map of the corners in a field */
+void print_map(field_t *field)
+{
+	int x, y, i, x_d = field->x_dim;
+	int *box = field->box;
+	int *cost = safe_malloc((box[2] - box[0] + 1) * sizeof(int));
+	uint32_t index, index_2;
+
+	printf("\nS3:");
+	for (i = box[0]; i <= box[2]; i++)
+	{
+		printf("%9d", i);
+	}
+	printf("\nS3:   %s", BORDER_CNR);
+	for (i = box[0]; i < box[2]; i++)
+	{
+		printf(BORDER_TOP);
+	}
+	for (y = box[1]; y <= box[3]; y++)
+	{
+		printf("\nS3: %c%s", y + 'a', BORDER_SIDE);
+		field_decode(field, field_local(field, y * x_d + box[0]),
+			box[2] - box[0] + 1, cost);
+		for (x = box[0]; x <= box[2]; x++)
+		{
+			/* print the arrow to/from the west */
+			index = y * x_d + x;
+			/* check there is a corner to the west */
+			if (x > box[0])
+			{
+				index_2 = index + dir_offset(WEST, x_d);
+				printf(field_via(field, index_2) == index ? ARROW_WEST :
+				       field_via(field, index) == index_2 ? ARROW_EAST :
+				                                            BLANK_LAT);
+			}
+			printf("%4d", cost[x - box[0]]);
+		}
+		for (i = 0; y != box[3] && i < LON_LEN; i++)
+		{
+			printf("\nS3:  %s", BORDER_SIDE);
+			for (x = box[0]; x <= box[2]; x++)
+			{
+				/* print the arrow to/from the south */
+				index = y * x_d + x;
+				/* check there is a corner to the south */
+				if (y < box[3])
+				{
+					index_2 = index + dir_offset(SOUTH, x_d);
+					printf(field_via(field, index_2) == index ? ARROW_SOUTH :
+						   field_via(field, index) == index_2 ? ARROW_NORTH :
+						                                        BLANK_LON);
+				}
+				if (x < box[2])
+				{
+					printf(BLANK_LAT);
+				}
+			}
+		}
+	}
+	printf("\n\n");
+	free(cost);
+	cost = NULL;
+}
+
+/* put a region's corners in order, and fit it to the city */
+void fit_region(city_t *city, int *region)
+{
+	int i, tmp, dim[2] = {city->x_dim, city->y_dim};
+
+	for (i = 0; i < 2; i++)
+	{
+		if (region[i] > region[i + 2])
+		{
+			tmp = region[i];
+			region[i] = region[i + 2];
+			region[i + 2] = tmp;
+		}
+		if (region[i] >= dim[i] || region[i + 2] < 0)
+		{
+			/* nothing of it is in the city */
+			exit(EXIT_FAILURE);
+		}
+		region[i] = (region[i] < 0) ? 0 : region[i];
+		region[i + 2] = (region[i + 2] >= dim[i]) ? dim[i] - 1 :
+		                                            region[i + 2];
+	}
+}
+
+/* return whether a corner is in a region */
+int in_region(city_t *city, int *region, uint32_t cnr)
+{
+	int x = cnr % city->x_dim, y = cnr / city->x_dim;
+	return x >= region[0] && x <= region[2] &&
+	       y >= region[1] && y <= region[3];
+}
+
+/* answer queries from stdin, one to a line, until the end of input. a line
+   of corner names prints all three stages for them as the locations, as a
+   city read with them would. a line of a corner, a direction from
+   DIR_CHARS and a time, eg. 3b E 25, sets the time of that street, or
+   closes it if the time is MAX_SECS.
+   queries go through a pipeline of three stages, each in its own thread:
+   this one reads and parses them, the next finds their paths and the last
+   prints them, so printing a large map overlaps with finding the next.
+   the latency of each stage is reported at the end */
+void serve_queries(city_t *city, tree_t *tree, opts_t *opts)
+{
+	int i;
+	char *line = NULL;
+	size_t size = 0;
+	double start;
+	query_t *query;
+	pthread_t solver, renderer;
+	server_t *server = safe_malloc(sizeof(server_t));
+	char *stages[] = {"parse", "solve", "render", "total"};
+
+	server->city = city;
+	server->tree = tree;
+	server->opts = opts;
+	new_pipe(&server->to_solve);
+	new_pipe(&server->to_render);
+	memset(server->hist, 0, sizeof(server->hist));
+	if (pthread_create(&solver, NULL, solve_queries, server) ||
+		pthread_create(&renderer, NULL, render_queries, server))
+	{
+		exit(EXIT_FAILURE);
+	}
+
+	while (getline(&line, &size, stdin) > 0)
+	{
+		/* timed from once the line is in, not while waiting for it */
+		start = now_secs();
+		if ((query = parse_query(city, line)))
+		{
+			query->read = start;
+			hist_add(&server->hist[0], now_secs() - start);
+			pipe_push(&server->to_solve, query);
+		}
+	}
+	pipe_push(&server->to_solve, NULL);
+	pthread_join(solver, NULL);
+	pthread_join(renderer, NULL);
+
+	for (i = 0; i <= STAGES; i++)
+	{
+		print_hist(&server->hist[i], stages[i], stderr);
+	}
+	free_pipe(&server->to_solve);
+	free_pipe(&server->to_render);
+	free(line);
+	line = NULL;
+	free(server);
+	server = NULL;
+}
+
+/* return a new query from a line, or NULL if it is empty or names a corner
+   that isn't in the city */
+query_t* parse_query(city_t *city, char *line)
+{
+	char *tok, *next;
+	query_t *query;
+
+	if (!(tok = strtok(line, " \t\n")))
+	{
+		return NULL;
+	}
+	query = safe_malloc(sizeof(query_t));
+	query->locs.items = query->routes.items = NULL;
+	query->locs.len = query->routes.len = 0;
+	query->locs.size = query->routes.size = 0;
+	query->field = NULL;
+	query->cnr = NO_CNR;
+	next = strtok(NULL, " \t\n");
+	if (next && !next[1] && strchr(DIR_CHARS, next[0]))
+	{
+		/* a street to change */
+		query->dir = strchr(DIR_CHARS, next[0]) - DIR_CHARS;
+		next = strtok(NULL, " \t\n");
+		if (!next || sscanf(next, "%d", &query->secs) != 1 ||
+			(query->cnr = cnr_index(city, tok)) == NO_CNR)
+		{
+			fprintf(stderr, "Q: no street %s %c\n", tok,
+				DIR_CHARS[query->dir]);
+			free_query(query);
+			return NULL;
+		}
+		return query;
+	}
+	/* locations to print the stages for */
+	for (; tok; tok = next, next = next ? strtok(NULL, " \t\n") : NULL)
+	{
+		if (cnr_index(city, tok) == NO_CNR)
+		{
+			fprintf(stderr, "Q: no corner %s\n", tok);
+			free_query(query);
+			return NULL;
+		}
+		vec_push(cnr_index(city, tok), &query->locs);
+	}
+	return query;
+}
+
+/* the solve stage of serve_queries: change streets, and find the routes
+   and map of each query, for the render stage. it alone changes the city,
+   so the others never see one half changed */
+void* solve_queries(void *arg)
+{
+	double start;
+	char name[NAME_LEN];
+	query_t *query;
+	server_t *server = arg;
+	city_t *city = server->city;
+	opts_t *opts = server->opts;
+
+	while ((query = pipe_pop(&server->to_solve)))
+	{
+		start = now_secs();
+		if (query->cnr == NO_CNR)
+		{
+			/* stage 1 is of the city as it is now */
+			query->head = *city;
+			find_routes(city, &query->locs, server->tree, opts,
+				&query->routes);
+			query->field = find_map(city, &query->locs, server->tree, opts);
+		}
+		else if (opts->attach || opts->pager)
+		{
+			/* it is read only, or would change the city file */
+			fprintf(stderr, "Q: a shared or paged city can't be changed\n");
+		}
+		else if (!set_street(city, query->cnr, query->dir, query->secs))
+		{
+			fprintf(stderr, "Q: can't set street %s %c to %d seconds\n",
+				cnr_name(city, query->cnr, name), DIR_CHARS[query->dir],
+				query->secs);
+		}
+		else
+		{
+			/* which its shortcuts and block costs may have used */
+			if (opts->ch)
+			{
+				free(opts->ch);
+				opts->ch = build_ch(city);
+			}
+			if (opts->overlay)
+			{
+				free_overlay(opts->overlay);
+				opts->overlay = build_overlay(city, opts->block);
+			}
+		}
+		hist_add(&server->hist[1], now_secs() - start);
+		if (query->cnr == NO_CNR)
+		{
+			pipe_push(&server->to_render, query);
+		}
+		else
+		{
+			free_query(query);
+		}
+	}
+	pipe_push(&server->to_render, NULL);
+	return NULL;
+}
+
+/* the render stage of serve_queries: print each query's stages */
+void* render_queries(void *arg)
+{
+	double start;
+	query_t *query;
+	server_t *server = arg;
+
+	while ((query = pipe_pop(&server->to_render)))
+	{
+		start = now_secs();
+		print_stage_1(&query->head, &query->locs);
+		print_routes(&query->head, &query->routes);
+		print_map(query->field);
+		hist_add(&server->hist[2], now_secs() - start);
+		hist_add(&server->hist[3], now_secs() - query->read);
+		free_query(query);
+	}
+	fflush(stdout);
+	return NULL;
+}
+
+void free_query(query_t *query)
+{
+	clear_vec(&query->locs);
+	clear_vec(&query->routes);
+	free(query->field);
+	free(query);
+}
+
+/* read from stdin: x_dim y_dim [corner name [4 travel times]] [locations],
+   and use this to build our city. it is assumed to be valid data */
+city_t* read_city_data()
+{
+	int dir, x_d, y_d;
+	uint32_t i;
+	city_t *city;
+	vec_t locs = {NULL, 0, 0};
+
+	/* read the city dimensions */
+	if (scanf(" %d %d", &x_d, &y_d) != 2)
+	{
+		exit(EXIT_FAILURE);
+	}
+
+	/* initialise the city, leaving the locations to be added at the end */
+	city = safe_malloc(sizeof(city_t) + x_d * y_d * sizeof(node_t));
+	city->x_dim = x_d;
+	city->y_dim = y_d;
+	city->n_cnrs = x_d * y_d;
+	city->n_locs = city->version = 0;
+	node_t *cnrs = city_cnrs(city);
+	for (i = 0; i < city->n_cnrs; i++)
+	{
+		for (dir = 0; dir < CARD_DIRS; dir++)
+		{
+			cnrs[i].out[dir].to = NO_CNR;
+			cnrs[i].out[dir].weight = MAX_SECS;
+		}
+	}
+	city->total_secs = city->unusable = 0;
+
+	read_cnrs(city, cnrs, NULL);
+
+	/* read all of the corner data, now onto the taxis, which go on the
+	   end of the city block */
+	read_locs(city, &locs);
+	city = safe_realloc(city, sizeof(city_t) + city->n_cnrs * sizeof(node_t)
+		+ locs.len * sizeof(uint32_t));
+	city->n_locs = locs.len;
+	if (locs.len)
+	{
+		memcpy(city_locs(city), locs.items, locs.len * sizeof(uint32_t));
+	}
+	clear_vec(&locs);
+	return city;
+}
+
+/* read data for each corner and its street travel times into cnrs, or
+   through pager if it is set, adding to the city's totals */
+void read_cnrs(city_t *city, node_t *cnrs, pager_t *pager)
+{
+	int index, dir, secs;
+	uint32_t i;
+	char tmp[NAME_LEN];
+	edge_t *st;
+
+	for (i = 0; i < city->n_cnrs && scanf(" %15s", tmp) > 0; i++)
+	{
+		/* index : x-value + y-value * x-dimension */
+		index = atoi(tmp) + (tmp[strlen(tmp) - 1] - 'a') * city->x_dim;
+		/* read street times */
+		for (dir = 0; dir < CARD_DIRS; dir++)
+		{
+			if (scanf(" %d" , &secs) < 0)
+			{
+				/* no value read */
+				exit(EXIT_FAILURE);
+			}
+			if (secs == MAX_SECS)
+			{
+				/* street is unusable */
+				city->unusable++;
+			}
+			else
+			{
+				/* we have a valid street */
+				st = pager ? &pager_cnr(pager, index, 1)->out[dir] :
+				             &cnrs[index].out[dir];
+				city->total_secs += (st->weight = secs);
+				/* corner in the current dir, by index */
+				st->to = index + dir_offset(dir, city->x_dim);
+			}
+		}
+	}
+}
+
+/* read corner names from stdin until the end of input, adding their
+   indices to locs */
+void read_locs(city_t *city, vec_t *locs)
+{
+	char tmp[NAME_LEN];
+
+	while (scanf(" %15s", tmp) > 0)
+	{
+		vec_push(atoi(tmp) + (tmp[strlen(tmp) - 1] - 'a') * city->x_dim,
+			locs);
+	}
+}
+
+/* read the city like read_city_data, but by mapping stdin and parsing it
+   with threads. if stdin can't be mapped, eg. a pipe, it is read as usual */
+city_t* read_city_parallel(int threads)
+{
+	struct stat st;
+	char *map;
+	city_t *city;
+
+	if (fstat(STDIN_FILENO, &st) || !S_ISREG(st.st_mode) || !st.st_size ||
+		(map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, STDIN_FILENO,
+		0)) == MAP_FAILED)
+	{
+		return read_city_data();
+	}
+	city = parse_city(map, map + st.st_size, threads);
+	munmap(map, st.st_size);
+	return city;
+}
+
+/* parse a city from text in memory, with threads. the text after the
+   dimensions is split into a chunk per thread at line starts. each thread
+   counts its tokens, and initialises its share of corners, then once the
+   counts before each chunk are known, each loads its corners (the first
+   CARD_DIRS + 1 tokens per corner, as scanf would read them) and then its
+   locations. totals are kept per thread and summed */
+city_t* parse_city(char *map, char *end, int threads)
+{
+	int i, j, x_d, y_d;
+	long tokens = 0;
+	char *body, *tok;
+	city_t *city;
+	load_t *loads = safe_malloc(threads * sizeof(load_t));
+	pthread_t *ids = safe_malloc(threads * sizeof(pthread_t));
+	vec_t locs = {NULL, 0, 0};
+
+	/* read the city dimensions */
+	if (!(tok = next_token(map, end, &body)) ||
+		(x_d = token_int(tok, body)) <= 0 ||
+		!(tok = next_token(body, end, &body)) ||
+		(y_d = token_int(tok, body)) <= 0)
+	{
+		exit(EXIT_FAILURE);
+	}
+	city = safe_malloc(sizeof(city_t) + x_d * y_d * sizeof(node_t));
+	city->x_dim = x_d;
+	city->y_dim = y_d;
+	city->n_cnrs = x_d * y_d;
+	city->n_locs = city->version = 0;
+	city->total_secs = city->unusable = 0;
+
+	for (i = 0; i < threads; i++)
+	{
+		loads[i].start = (i == 0) ? body : loads[i - 1].end;
+		loads[i].end = (i == threads - 1) ? end :
+			body + (end - body) * (i + 1) / threads;
+		if (loads[i].end < loads[i].start)
+		{
+			loads[i].end = loads[i].start;
+		}
+		/* move the end to the start of the next line */
+		while (loads[i].end < end && loads[i].end > loads[i].start &&
+			loads[i].end[-1] != '\n')
+		{
+			loads[i].end++;
+		}
+		loads[i].map_end = end;
+		loads[i].city = city;
+		loads[i].first_cnr = (uint64_t)city->n_cnrs * i / threads;
+		loads[i].last_cnr = (uint64_t)city->n_cnrs * (i + 1) / threads;
+		loads[i].total_secs = loads[i].unusable = 0;
+		loads[i].locs.items = NULL;
+		loads[i].locs.len = loads[i].locs.size = 0;
+	}
+
+	/* count tokens, and initialise the corners */
+	for (i = 1; i < threads; i++)
+	{
+		if (pthread_create(&ids[i], NULL, load_count, &loads[i]))
+		{
+			exit(EXIT_FAILURE);
+		}
+	}
+	load_count(&loads[0]);
+	for (i = 1; i < threads; i++)
+	{
+		pthread_join(ids[i], NULL);
+	}
+	for (i = 0; i < threads; i++)
+	{
+		loads[i].first_token = tokens;
+		tokens += loads[i].tokens;
+	}
+
+	/* load the corners and locations */
+	for (i = 1; i < threads; i++)
+	{
+		if (pthread_create(&ids[i], NULL, load_cnrs, &loads[i]))
+		{
+			exit(EXIT_FAILURE);
+		}
+	}
+	load_cnrs(&loads[0]);
+	for (i = 1; i < threads; i++)
+	{
+		pthread_join(ids[i], NULL);
+	}
+	for (i = 0; i < threads; i++)
+	{
+		city->total_secs += loads[i].total_secs;
+		city->unusable += loads[i].unusable;
+		/* locations go in the order of the chunks */
+		for (j = 0; j < loads[i].locs.len; j++)
+		{
+			vec_push(loads[i].locs.items[j], &locs);
+		}
+		clear_vec(&loads[i].locs);
+	}
+	free(loads);
+	free(ids);
+
+	city = safe_realloc(city, sizeof(city_t) + city->n_cnrs * sizeof(node_t)
+		+ locs.len * sizeof(uint32_t));
+	city->n_locs = locs.len;
+	if (locs.len)
+	{
+		memcpy(city_locs(city), locs.items, locs.len * sizeof(uint32_t));
+	}
+	clear_vec(&locs);
+	return city;
+}
+
+/* the first pass of parse_city over a chunk: count its tokens, and
+   initialise its share of the corners, as read_city_data does */
+void* load_count(void *arg)
+{
+	int dir;
+	uint32_t i;
+	char *p = NULL;
+	load_t *load = arg;
+	node_t *cnrs = city_cnrs(load->city);
+
+	for (i = load->first_cnr; i < load->last_cnr; i++)
+	{
+		for (dir = 0; dir < CARD_DIRS; dir++)
+		{
+			cnrs[i].out[dir].to = NO_CNR;
+			cnrs[i].out[dir].weight = MAX_SECS;
+		}
+	}
+	for (load->tokens = 0;
+		next_token(p ? p : load->start, load->end, &p); load->tokens++);
+	return NULL;
+}
+
+/* the second pass of parse_city over a chunk: load the corners that start
+   in it, reading their times past its end if need be, then its locations */
+void* load_cnrs(void *arg)
+{
+	int dir, secs;
+	long token = 0, corner_tokens;
+	uint32_t index;
+	char *tok, *p;
+	load_t *load = arg;
+	city_t *city = load->city;
+	node_t *cnrs = city_cnrs(city);
+	edge_t *st;
+
+	corner_tokens = (long)city->n_cnrs * (CARD_DIRS + 1);
+	token = load->first_token;
+	p = load->start;
+	/* the end of a corner started in the last chunk */
+	for (; token < corner_tokens && token % (CARD_DIRS + 1); token++)
+	{
+		if (!next_token(p, load->end, &p))
+		{
+			return NULL;
+		}
+	}
+	while ((tok = next_token(p, load->end, &p)))
+	{
+		if (token++ >= corner_tokens)
+		{
+			vec_push(token_cnr(city, tok, p), &load->locs);
+			continue;
+		}
+		if ((index = token_cnr(city, tok, p)) >= city->n_cnrs)
+		{
+			exit(EXIT_FAILURE);
+		}
+		for (dir = 0; dir < CARD_DIRS; dir++, token++)
+		{
+			if (!(tok = next_token(p, load->map_end, &p)))
+			{
+				/* no value read */
+				exit(EXIT_FAILURE);
+			}
+			if ((secs = token_int(tok, p)) == MAX_SECS)
+			{
+				/* street is unusable */
+				load->unusable++;
+			}
+			else
+			{
+				st = &cnrs[index].out[dir];
+				load->total_secs += (st->weight = secs);
+				st->to = index + dir_offset(dir, city->x_dim);
+			}
+		}
+	}
+	return NULL;
+}
+
+/* return the start of the next token from p, before end, putting the end
+   of it in tok_end, or NULL if there isn't one */
+char* next_token(char *p, char *end, char **tok_end)
+{
+	char *tok;
+
+	while (p < end && isspace((unsigned char)*p))
+	{
+		p++;
+	}
+	if (p >= end)
+	{
+		return NULL;
+	}
+	for (tok = p; p < end && !isspace((unsigned char)*p); p++);
+	*tok_end = p;
+	return tok;
+}
+
+/* the number at the start of a token, as atoi would read it */
+int token_int(char *tok, char *end)
+{
+	int n = 0, sign = 1;
+
+	if (tok < end && (*tok == '-' || *tok == '+'))
+	{
+		sign = (*tok++ == '-') ? -1 : 1;
+	}
+	for (; tok < end && isdigit((unsigned char)*tok); tok++)
+	{
+		n = n * 10 + *tok - '0';
+	}
+	return sign * n;
+}
+
+/* the index of a corner named by a token, eg. 3b */
+uint32_t token_cnr(city_t *city, char *tok, char *end)
+{
+	return token_int(tok, end) + (end[-1] - 'a') * city->x_dim;
+}
+
+/* time parsing the mapped stdin with 1, 2, 4 ... up to threads threads */
+void bench_load(int threads, int runs)
+{
+	int i, n;
+	struct stat st;
+	struct timespec start, stop;
+	char *map;
+	double ms, base = 0;
+
+	if (fstat(STDIN_FILENO, &st) || !S_ISREG(st.st_mode) || !st.st_size ||
+		(map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, STDIN_FILENO,
+		0)) == MAP_FAILED)
+	{
+		printf("B: stdin can't be mapped, so is read with scanf\n");
+		return;
+	}
+	for (n = 1; n <= threads; n = (n * 2 > threads && n < threads) ?
+		threads : n * 2)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < runs; i++)
+		{
+			free(parse_city(map, map + st.st_size, n));
+		}
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+		ms = (1000.0 * (stop.tv_sec - start.tv_sec) +
+			(stop.tv_nsec - start.tv_nsec) / 1e6) / runs;
+		base = (n == 1) ? ms : base;
+		printf("B: load with %2d threads, %d runs, %.3f ms per run, "
+			"%.2fx\n", n, runs, ms, base / ms);
+	}
+	munmap(map, st.st_size);
+}
+
+/* time the statistics of the city's streets, one corner at a time then
+   with SSE2, and check they agree */
+void bench_stats(city_t *city, int runs)
+{
+	int i;
+	struct timespec start, stop;
+	stats_t stats[2];   /* found by each */
+	double ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < runs; i++)
+	{
+		city_stats_scalar(city, &stats[0]);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	ms = (1000.0 * (stop.tv_sec - start.tv_sec) +
+		(stop.tv_nsec - start.tv_nsec) / 1e6) / runs;
+	printf("B: scalar stats, %d runs, %.3f ms per run, %.0f MB/s\n", runs,
+		ms, city->n_cnrs * sizeof(node_t) / ms / 1e3);
+#ifdef __SSE2__
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < runs; i++)
+	{
+		city_stats_sse2(city, &stats[1]);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	ms = (1000.0 * (stop.tv_sec - start.tv_sec) +
+		(stop.tv_nsec - start.tv_nsec) / 1e6) / runs;
+	printf("B: sse2   stats, %d runs, %.3f ms per run, %.0f MB/s\n", runs,
+		ms, city->n_cnrs * sizeof(node_t) / ms / 1e3);
+	printf("B: stats %s\n", memcmp(&stats[0], &stats[1], sizeof(stats_t)) ?
+		"disagree" : "agree");
+#endif
+}
+
+/* the corners of a city, which follow its header */
+node_t* city_cnrs(city_t *city)
+{
+	return (node_t*)(city + 1);
+}
+
+/* the taxi locations of a city, which follow its corners */
+uint32_t* city_locs(city_t *city)
+{
+	return (uint32_t*)(city_cnrs(city) + city->n_cnrs);
+}
+
+/* the number of bytes in a city block */
+size_t city_size(city_t *city)
+{
+	return sizeof(city_t) + city->n_cnrs * sizeof(node_t)
+		+ city->n_locs * sizeof(uint32_t);
+}
+
+/* copy a city into a new POSIX shared memory object, which replaces any
+   city already published under name. processes attached to the old city
+   keep using it until they detach. the object starts as zeros, and the
+   header's n_cnrs is written last, so until it isn't 0, the city is only
+   partly copied */
+void publish_city(city_t *city, char *name)
+{
+	int fd;
+	city_t head = *city, *shared;
+	size_t size = city_size(city);
+
+	shm_unlink(name);
+	if ((fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644)) < 0 ||
+		ftruncate(fd, size) < 0 || (shared = mmap(NULL, size,
+		PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+	{
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+	memcpy(shared + 1, city + 1, size - sizeof(city_t));
+	head.n_cnrs = 0;
+	*shared = head;
+	/* everything before it is written before it can be seen */
+	atomic_store_explicit((_Atomic uint32_t*)&shared->n_cnrs, city->n_cnrs,
+		memory_order_release);
+	munmap(shared, size);
+	close(fd);
+}
+
+/* map a city published under name read only, and return it. it is
+   unmapped with munmap(city, city_size(city)) */
+city_t* attach_city(char *name)
+{
+	int fd;
+	struct stat st;
+	city_t *city = MAP_FAILED;
+
+	if ((fd = shm_open(name, O_RDONLY, 0)) < 0 || fstat(fd, &st) < 0 ||
+		(city = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) ==
+		MAP_FAILED)
+	{
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+	close(fd);
+	/* not yet published, or not a city */
+	if ((size_t)st.st_size < sizeof(city_t) ||
+		!atomic_load_explicit((_Atomic uint32_t*)&city->n_cnrs,
+		memory_order_acquire) || city_size(city) != (size_t)st.st_size)
+	{
+		fprintf(stderr, "%s: not a whole city\n", name);
+		exit(EXIT_FAILURE);
+	}
+	return city;
+}
+
+/* read a city written by write_city_file, and its contraction hierarchy
+   into ch, or NULL if it has none */
+city_t* read_city_file(char *name, ch_t **ch)
+{
+	FILE *fp;
+	city_t head, *city;
+	ch_t ch_head;
+
+	if (!(fp = fopen(name, "rb")))
+	{
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+	if (fread(&head, sizeof(city_t), 1, fp) != 1 || head.x_dim <= 0 ||
+		head.y_dim <= 0 || head.n_cnrs != (uint32_t)(head.x_dim * head.y_dim))
+	{
+		exit(EXIT_FAILURE);
+	}
+	city = safe_malloc(city_size(&head));
+	*city = head;
+	if (fread(city + 1, city_size(city) - sizeof(city_t), 1, fp) != 1)
+	{
+		exit(EXIT_FAILURE);
+	}
+	*ch = NULL;
+	if (fread(&ch_head, sizeof(ch_t), 1, fp) == 1)
+	{
+		if (ch_head.n_cnrs != city->n_cnrs)
+		{
+			exit(EXIT_FAILURE);
+		}
+		*ch = safe_malloc(ch_size(&ch_head));
+		**ch = ch_head;
+		if (fread(*ch + 1, ch_size(*ch) - sizeof(ch_t), 1, fp) != 1)
+		{
+			exit(EXIT_FAILURE);
+		}
+	}
+	fclose(fp);
+	return city;
+}
+
+/* write a city, then its contraction hierarchy if it has one, to a file.
+   both are single blocks, so are written as is */
+void write_city_file(city_t *city, ch_t *ch, char *name)
+{
+	FILE *fp;
+
+	if (!(fp = fopen(name, "wb")) ||
+		fwrite(city, city_size(city), 1, fp) != 1 ||
+		(ch && fwrite(ch, ch_size(ch), 1, fp) != 1) || fclose(fp))
+	{
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* open a binary city file to be read through a pager, and return just
+   its header */
+city_t* read_city_paged(char *name, opts_t *opts)
+{
+	FILE *fp;
+	city_t *city = safe_malloc(sizeof(city_t));
+
+	if (!(fp = fopen(name, "rb")))
+	{
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+	if (fread(city, sizeof(city_t), 1, fp) != 1 || city->x_dim <= 0 ||
+		city->y_dim <= 0 ||
+		city->n_cnrs != (uint32_t)(city->x_dim * city->y_dim))
+	{
+		exit(EXIT_FAILURE);
+	}
+	opts->pager = new_pager(fp, city, opts);
+	return city;
+}
+
+/* read a city from stdin, like read_city_data, but into a binary city file
+   through a pager, and return just its header. all corners start with no
+   usable streets, as in read_city_data */
+city_t* write_city_paged(char *name, opts_t *opts)
+{
+	int dir;
+	uint32_t i;
+	FILE *fp;
+	city_t *city = safe_malloc(sizeof(city_t));
+	node_t none;
+	vec_t locs = {NULL, 0, 0};
+
+	if (scanf(" %d %d", &city->x_dim, &city->y_dim) != 2 ||
+		city->x_dim <= 0 || city->y_dim <= 0)
+	{
+		exit(EXIT_FAILURE);
+	}
+	city->n_cnrs = city->x_dim * city->y_dim;
+	city->total_secs = city->unusable = 0;
+	city->n_locs = city->version = 0;
+	for (dir = 0; dir < CARD_DIRS; dir++)
+	{
+		none.out[dir].to = NO_CNR;
+		none.out[dir].weight = MAX_SECS;
+	}
+	if (!(fp = fopen(name, "w+b")) || fwrite(city, sizeof(city_t), 1, fp) != 1)
+	{
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < city->n_cnrs; i++)
+	{
+		if (fwrite(&none, sizeof(node_t), 1, fp) != 1)
+		{
+			perror(name);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	opts->pager = new_pager(fp, city, opts);
+	read_cnrs(city, NULL, opts->pager);
+	pager_flush(opts->pager);
+
+	/* the locations go on the end, then the header has its totals */
+	read_locs(city, &locs);
+	city->n_locs = locs.len;
+	if (fseek(fp, sizeof(city_t) + city->n_cnrs * sizeof(node_t), SEEK_SET) ||
+		(locs.len &&
+		 fwrite(locs.items, sizeof(uint32_t), locs.len, fp) !=
+		 (size_t)locs.len) ||
+		fseek(fp, 0, SEEK_SET) || fwrite(city, sizeof(city_t), 1, fp) != 1 ||
+		fflush(fp))
+	{
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+	clear_vec(&locs);
+	return city;
+}
+
+/* read the locations stored in a paged binary city file into locs */
+void read_paged_locs(city_t *city, pager_t *pager, vec_t *locs)
+{
+	uint32_t i, cnr;
+
+	if (fseek(pager->fp, sizeof(city_t) + city->n_cnrs * sizeof(node_t),
+		SEEK_SET))
+	{
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < city->n_locs; i++)
+	{
+		if (fread(&cnr, sizeof(uint32_t), 1, pager->fp) != 1)
+		{
+			exit(EXIT_FAILURE);
+		}
+		vec_push(cnr, locs);
+	}
+}
+
+/* write the name of a corner, eg. 3b, into name, and return name */
+char* cnr_name(city_t *city, uint32_t index, char *name)
+{
+	sprintf(name, "%d%c", index % city->x_dim, index / city->x_dim + 'a');
+	return name;
+}
+
+/* return the index of a named corner, eg. 3b, or NO_CNR if it isn't one of
+   the city's */
+uint32_t cnr_index(city_t *city, char *name)
+{
+	int x = atoi(name), y = name[strlen(name) - 1] - 'a';
+
+	if (!isdigit((unsigned char)name[0]) || x >= city->x_dim || y < 0 ||
+		y >= city->y_dim)
+	{
+		return NO_CNR;
+	}
+	return x + y * city->x_dim;
+}
+
+/* set the time of the street from cnr in direction dir, keeping the
+   city's totals, and give the city a new version. return 0 if there is no
+   such street or the time isn't from 1 to MAX_SECS, as in a city file,
+   else 1 */
+int set_street(city_t *city, uint32_t cnr, int dir, int secs)
+{
+	edge_t *st = &city_cnrs(city)[cnr].out[dir];
+	uint32_t to = neighbour(city, cnr, dir);
+
+	if (to == NO_CNR || secs < 1 || secs > MAX_SECS)
+	{
+		return 0;
+	}
+	/* take the old time from the totals, then add the new one */
+	if (st->to == NO_CNR)
+	{
+		city->unusable--;
+	}
+	else
+	{
+		city->total_secs -= st->weight;
+	}
+	if (secs == MAX_SECS)
+	{
+		city->unusable++;
+		st->to = NO_CNR;
+		st->weight = MAX_SECS;
+	}
+	else
+	{
+		city->total_secs += (st->weight = secs);
+		st->to = to;
+	}
+	city->version++;
+	return 1;
+}
+
+/* return the corner next to cnr in direction dir, or NO_CNR if it is off
+   the edge of the grid */
+uint32_t neighbour(city_t *city, uint32_t cnr, int dir)
+{
+	int x = cnr % city->x_dim, y = cnr / city->x_dim;
+	if ((dir == EAST && x + 1 == city->x_dim) || (dir == NORTH && !y) ||
+		(dir == WEST && !x) || (dir == SOUTH && y + 1 == city->y_dim))
+	{
+		return NO_CNR;
+	}
+	return cnr + dir_offset(dir, city->x_dim);
+}
+
+/* return the index offset in a given dirention */
+int dir_offset(int dir, int x_dim)
+{
+	return (dir == EAST) ? 1 :
+		   (dir == NORTH)? - x_dim :
+		   (dir == WEST) ? - 1 :
+						   x_dim;
+}
+
+/* find the shortest paths to all nodes from any of the n_starts starts.
+   this is a version of Dijkstra's algorithm (1956), modified to allow for
+   multiple starting nodes. opts selects the frontier used, and the traffic
+   model, if any, which needs the expanded search. static paths over the
+   whole city are looked up in, or added to, its cache if it has one */
+void find_paths(city_t *city, uint32_t *starts, int n_starts, opts_t *opts,
+	tree_t *tree)
+{
+	int i, len = 0;
+	uint32_t label, *key = NULL;
+	/* the overlay only settles the corners it is asked for */
+	int cached = opts->cache && !opts->traffic && !opts->overlay;
+
+	if (cached)
+	{
+		key = safe_malloc((n_starts + 1) * sizeof(uint32_t));
+		len = cache_key(starts, n_starts, key);
+		if (cache_find(opts->cache, city, key, len, tree))
+		{
+			free(key);
+			return;
+		}
+	}
+
+	/* initialise node data */
+	tree->states = opts->traffic ? STATES : 1;
+	for (label = 0; label < city->n_cnrs * tree->states; label++)
+	{
+		tree->via[label] = NO_CNR;
+		tree->cost[label] = MAX_SECS;
+	}
+	for (i = 0; i < n_starts; i++)
+	{
+		tree->cost[opts->traffic ? starts[i] * STATES + HALT : starts[i]] = 0;
+	}
+
+	if (opts->traffic)
+	{
+		find_paths_expanded(city, starts, n_starts, opts->traffic, tree);
+	}
+	else if (opts->overlay)
+	{
+		find_paths_overlay(city, opts->overlay, starts, n_starts, tree);
+	}
+	else if (opts->engine == ENGINE_DIAL || opts->pager || opts->region)
+	{
+		find_paths_dial(city, opts->pager, opts->region, starts, n_starts,
+			tree);
+	}
+	else
+	{
+		find_paths_queue(city, starts, n_starts, tree);
+	}
+
+	if (cached)
+	{
+		/* a region's search may stop before the rest is settled */
+		if (!opts->region)
+		{
+			cache_add(opts->cache, city, key, len, tree);
+		}
+		free(key);
+		key = NULL;
+	}
+}
+
+/* label-correcting search with a fifo queue, nodes may be checked more
+   than once if a lower cost path to them is found later */
+void find_paths_queue(city_t *city, uint32_t *starts, int n_starts,
+	tree_t *tree)
+{
+	int i;
+	uint32_t cur;
+	edge_t *out;
+	queue_t *to_check = new_queue();
+
+	for (i = 0; i < n_starts; i++)
+	{
+		enqueue(starts[i], to_check);
+	}
+	while ((cur = dequeue(to_check)) != NO_CNR)
+	{
+		/* check each outgoing edge */
+		out = city_cnrs(city)[cur].out;
+		for (i = 0; i < CARD_DIRS; i++)
+		{
+			if (relax(city, tree, cur, &out[i]))
+			{
+				enqueue(out[i].to, to_check);
+			}
+		}
+	}
+	clear_queue(to_check);
+	free(to_check);
+	to_check = NULL;
+}
+
+/* dial's algorithm (1969): street times are all below MAX_SECS, so a
+   circular array of BUCKETS buckets, one per cost, can hold the whole
+   frontier, and each node is checked once, in order of cost.
+   stale entries (a lower cost has since been found) are skipped. if
+   pager is set, corners are read through it, not from the city. if region
+   is set, it stops once every corner in it is settled: a corner's via
+   can't change once it is checked, as ties only come from streets of
+   positive time, from corners checked before it */
+void find_paths_dial(city_t *city, pager_t *pager, int *region,
+	uint32_t *starts, int n_starts, tree_t *tree)
+{
+	int i, j, cost = 0, pending = 0, unsettled = 0;
+	uint32_t cur, to;
+	edge_t *out;
+	node_t *cnrs = city_cnrs(city);
+	vec_t *bucket, *buckets = tree->buckets;
+
+	for (i = 0; i < n_starts; i++)
+	{
+		vec_push(starts[i], &buckets[0]);
+		pending++;
+	}
+	if (region)
+	{
+		unsettled = (region[2] - region[0] + 1) * (region[3] - region[1] + 1);
+		/* a repeated start is checked again */
+		for (i = 0; i < n_starts; i++)
+		{
+			for (j = 0; j < i; j++)
+			{
+				unsettled += starts[j] == starts[i] &&
+					in_region(city, region, starts[i]);
+			}
+		}
+	}
+	while (pending)
+	{
+		/* advance to the next non-empty bucket */
+		while (!(bucket = &buckets[cost % BUCKETS])->len)
+		{
+			cost++;
+		}
+		cur = bucket->items[--bucket->len];
+		pending--;
+		if (tree->cost[cur] != cost)
+		{
+			continue;
+		}
+		if (region && in_region(city, region, cur) && !--unsettled)
+		{
+			break;
+		}
+		/* relax doesn't use the pager, so out stays valid */
+		out = pager ? pager_cnr(pager, cur, 0)->out : cnrs[cur].out;
+		for (i = 0; i < CARD_DIRS; i++)
+		{
+			if (relax(city, tree, cur, &out[i]))
+			{
+				to = out[i].to;
+				vec_push(to, &buckets[tree->cost[to] % BUCKETS]);
+				pending++;
+			}
+		}
+	}
+	/* empty any buckets left by stopping early */
+	for (i = 0; pending && i < BUCKETS; i++)
+	{
+		pending -= buckets[i].len;
+		buckets[i].len = 0;
+	}
+}
+
+/* dial's algorithm over the expanded states of each corner: the direction
+   it was arrived in, or HALT at a start. this is what turn costs depend on.
+   time of day street times depend on when a street is reached, which is
+   known as states are checked in order of cost. the expanded graph isn't
+   built, the streets of a state are those of its corner */
+void find_paths_expanded(city_t *city, uint32_t *starts, int n_starts,
+	traffic_t *traffic, tree_t *tree)
+{
+	int i, cost = 0, pending = 0, new_cost;
+	uint32_t cur, cnr, to;
+	edge_t *out;
+	vec_t *bucket, *buckets = tree->buckets;
+
+	for (i = 0; i < n_starts; i++)
+	{
+		vec_push(starts[i] * STATES + HALT, &buckets[0]);
+		pending++;
+	}
+	while (pending)
+	{
+		/* advance to the next non-empty bucket */
+		while (!(bucket = &buckets[cost % BUCKETS])->len)
+		{
+			cost++;
+		}
+		cur = bucket->items[--bucket->len];
+		pending--;
+		if (tree->cost[cur] != cost)
+		{
+			continue;
+		}
+		out = city_cnrs(city)[(cnr = cur / STATES)].out;
+		for (i = 0; i < CARD_DIRS; i++)
+		{
+			if (out[i].to == NO_CNR)
+			{
+				continue;
+			}
+			to = out[i].to * STATES + i;
+			new_cost = cost + turn_secs(traffic, cnr, cur % STATES, i);
+			new_cost += street_secs(traffic, out[i].weight, new_cost);
+			/* lower cost path to state */
+			if (new_cost < tree->cost[to])
+			{
+				tree->via[to] = cur;
+				tree->cost[to] = new_cost;
+				vec_push(to, &buckets[new_cost % BUCKETS]);
+				pending++;
+			}
+			/* cur new_cost is equal and is a better previous state, not
+			   through a zero time street, see relax */
+			else if (tree->via[to] != NO_CNR && new_cost == tree->cost[to] &&
+				cost < new_cost && better_via(city, tree, cur, tree->via[to]))
+			{
+				tree->via[to] = cur;
+			}
+		}
+	}
+}
+
+/* relax an edge from cur, returning 1 if the cost of the node it leads to
+   was lowered, meaning that node has to be checked (again) */
+int relax(city_t *city, tree_t *tree, uint32_t cur, edge_t *edge)
+{
+	uint32_t to = edge->to;
+	int new_cost;
+
+	if (to == NO_CNR)
+	{
+		/* street can't be used */
+		return 0;
+	}
+	new_cost = tree->cost[cur] + edge->weight;
+
+	/* lower cost path to node */
+	if (new_cost < tree->cost[to])
+	{
+		tree->via[to] = cur;
+		tree->cost[to] = new_cost;
+		return 1;
+	}
+	/* cur new_cost is equal and is lexographically lower. a zero time
+	   street can't be a tie, else vias could form a loop */
+	if (tree->via[to] != NO_CNR && new_cost == tree->cost[to] &&
+		edge->weight && lex_lower(city, cur, tree->via[to]))
+	{
+		tree->via[to] = cur;
+	}
+	return 0;
+}
+
+/* return whether corner a is lexographically lower than corner b, by x,
+   then by y */
+int lex_lower(city_t *city, uint32_t a, uint32_t b)
+{
+	int x_a = a % city->x_dim, x_b = b % city->x_dim;
+	return x_a < x_b || (x_a == x_b && a / city->x_dim < b / city->x_dim);
+}
+
+/* return the via find_paths would give cnr, from the costs of it and the
+   corners with streets to it: the lowest corner on a shortest path, not
+   using a zero time street unless there's no other way */
+uint32_t cost_via(city_t *city, int *cost, uint32_t cnr)
+{
+	int dir, weight, via_weight = 0;
+	uint32_t prev, via = NO_CNR;
+	node_t *cnrs = city_cnrs(city);
+
+	for (dir = 0; dir < CARD_DIRS; dir++)
+	{
+		if ((prev = neighbour(city, cnr, dir)) == NO_CNR ||
+			cnrs[prev].out[(dir + 2) % CARD_DIRS].to != cnr)
+		{
+			continue;
+		}
+		weight = cnrs[prev].out[(dir + 2) % CARD_DIRS].weight;
+		if (cost[prev] + weight == cost[cnr] && cost[cnr] < MAX_SECS &&
+			(via == NO_CNR || (weight && !via_weight) ||
+			 (!weight == !via_weight && lex_lower(city, prev, via))))
+		{
+			via = prev;
+			via_weight = weight;
+		}
+	}
+	return via;
+}
+
+/* return whether label a is a better previous label than b in paths of
+   equal cost: the lexographically lower corner, or for the same corner,
+   the one with the better via */
+int better_via(city_t *city, tree_t *tree, uint32_t a, uint32_t b)
+{
+	uint32_t cnr_a = a / tree->states, cnr_b = b / tree->states;
+	return (cnr_a != cnr_b) ? lex_lower(city, cnr_a, cnr_b) :
+	                          lower_via(city, tree, a, b);
+}
+
+/* return whether the via of label a is a lower one than that of b: no via
+   at all, then the lexographically lower corner */
+int lower_via(city_t *city, tree_t *tree, uint32_t a, uint32_t b)
+{
+	uint32_t via_a = tree->via[a], via_b = tree->via[b];
+	return via_b != NO_CNR && (via_a == NO_CNR ||
+		lex_lower(city, via_a / tree->states, via_b / tree->states));
+}
+
+/* return the label with the lowest cost path to cnr, ties going to the
+   lowest via, as find_paths would break them */
+uint32_t best_label(city_t *city, tree_t *tree, uint32_t cnr)
+{
+	int s;
+	uint32_t label, best = cnr * tree->states;
+
+	for (s = 1; s < tree->states; s++)
+	{
+		label = cnr * tree->states + s;
+		if (tree->cost[label] < tree->cost[best] ||
+			(tree->cost[label] == tree->cost[best] &&
+			 lower_via(city, tree, label, best)))
+		{
+			best = label;
+		}
+	}
+	return best;
+}
+
+/* the cost of the best path to cnr */
+int tree_cost(city_t *city, tree_t *tree, uint32_t cnr)
+{
+	return tree->cost[best_label(city, tree, cnr)];
+}
+
+/* the previous corner in the best path to cnr, or NO_CNR */
+uint32_t tree_via(city_t *city, tree_t *tree, uint32_t cnr)
+{
+	uint32_t via = tree->via[best_label(city, tree, cnr)];
+	return (via == NO_CNR) ? NO_CNR : via / tree->states;
+}
+
+/* write the best route found by find_paths to end into path, as labels
+   from the start of the route to end, and return its length. path must have
+   space for the longest possible route, one entry per label.
+   if turns is set, only the start, end and corners where the route changes
+   direction are written. 0 is returned if there is no route to end */
+int trace_path(city_t *city, tree_t *tree, uint32_t end, uint32_t *path,
+	int turns)
+{
+	int i, len = 0;
+	uint32_t cnr, *via = tree->via;
+
+	if (via[(end = best_label(city, tree, end))] == NO_CNR)
+	{
+		return 0;
+	}
+	/* count the corners, then fill path backwards from end. a route
+	   can't be longer than the number of labels */
+	for (cnr = end;
+		cnr != NO_CNR && (uint32_t)len < city->n_cnrs * tree->states;
+		cnr = via[cnr])
+	{
+		len++;
+	}
+	for (i = len, cnr = end; i > 0; cnr = via[cnr])
+	{
+		path[--i] = cnr;
+	}
+	return turns ? turns_only(city, path, len, tree->states) : len;
+}
+
+/* compact a path of len labels (of the given states per corner) in place,
+   keeping only the start, end and corners where it changes direction, and
+   return its new length */
+int turns_only(city_t *city, uint32_t *path, int len, int states)
+{
+	int i, kept = 1;
+
+	for (i = 1, len--; i < len; i++)
+	{
+		if (is_turn(city, path[kept - 1] / states, path[i] / states,
+			path[i + 1] / states))
+		{
+			path[kept++] = path[i];
+		}
+	}
+	path[kept++] = path[len];
+	return kept;
+}
+
+/* return whether a route from prev through cnr to next changes direction
+   at cnr. prev need not neighbour cnr, only be in line with it */
+int is_turn(city_t *city, uint32_t prev, uint32_t cnr, uint32_t next)
+{
+	int x_d = city->x_dim;
+	return (prev % x_d == cnr % x_d) != (cnr % x_d == next % x_d) ||
+	       (prev / x_d == cnr / x_d) != (cnr / x_d == next / x_d);
+}
+
+/* time runs of each engine over the whole city from every location, and
+   check that they agree on the result */
+void bench_paths(city_t *city, vec_t *locs, tree_t *tree, opts_t *opts)
+{
+	int i, engine, runs = opts->bench_runs;
+	clock_t start;
+	int *costs = safe_malloc(city->n_cnrs * sizeof(int));
+	uint32_t *vias = safe_malloc(city->n_cnrs * sizeof(uint32_t));
+	char *names[] = {"queue", "dial"};
+	/* only the static engines are compared */
+	opts_t engine_opts = *opts;
+
+	if (opts->pager)
+	{
+		/* only dial's engine can read a paged city */
+		start = clock();
+		for (i = 0; i < runs; i++)
+		{
+			find_paths(city, locs->items, locs->len, opts, tree);
+		}
+		/* its page faults are reported when it is freed */
+		printf("B: paged engine, %d runs, %.3f ms per run\n", runs,
+			1000.0 * (clock() - start) / CLOCKS_PER_SEC / runs);
+		free(costs);
+		free(vias);
+		return;
+	}
+	engine_opts.traffic = NULL;
+	engine_opts.overlay = NULL;
+	engine_opts.region = NULL;
+	engine_opts.cache = NULL;
+	for (engine = ENGINE_QUEUE; engine <= ENGINE_DIAL; engine++)
+	{
+		start = clock();
+		engine_opts.engine = engine;
+		for (i = 0; i < runs; i++)
+		{
+			find_paths(city, locs->items, locs->len, &engine_opts, tree);
+		}
+		printf("B: %-5s engine, %d runs, %.3f ms per run\n", names[engine],
+			runs, 1000.0 * (clock() - start) / CLOCKS_PER_SEC / runs);
+		if (engine == ENGINE_QUEUE)
+		{
+			/* what the others are checked against */
+			memcpy(costs, tree->cost, city->n_cnrs * sizeof(int));
+			memcpy(vias, tree->via, city->n_cnrs * sizeof(uint32_t));
+		}
+	}
+	bench_compare(city, NULL, costs, vias, tree->cost, tree->via,
+		"dial engine");
+	bench_field(city, tree, runs, costs, vias);
+	if (opts->overlay)
+	{
+		bench_overlay(city, locs, tree, opts->overlay, runs, costs, vias);
+	}
+	if (opts->region)
+	{
+		bench_region(city, locs, tree, opts->region, runs, costs, vias);
+	}
+	if (opts->cache)
+	{
+		bench_cache(city, locs, tree, opts, costs, vias);
+	}
+	free(costs);
+	free(vias);
+	if (opts->ch)
+	{
+		bench_ch(city, locs, tree, opts->ch, runs);
+	}
+}
+
+/* time searches that stop once the region is settled, and check its
+   corners against the costs and vias found over the whole city */
+void bench_region(city_t *city, vec_t *locs, tree_t *tree, int *region,
+	int runs, int *costs, uint32_t *vias)
+{
+	int i, settled = 0;
+	uint32_t cnr;
+	clock_t start;
+	opts_t opts = {.engine = ENGINE_DIAL};
+
+	opts.region = region;
+	start = clock();
+	for (i = 0; i < runs; i++)
+	{
+		find_paths(city, locs->items, locs->len, &opts, tree);
+	}
+	for (cnr = 0; cnr < city->n_cnrs; cnr++)
+	{
+		settled += tree->cost[cnr] != MAX_SECS;
+	}
+	printf("B: region search, %d runs, %.3f ms per run, %d of %d "
+		"intersections reached\n", runs,
+		1000.0 * (clock() - start) / CLOCKS_PER_SEC / runs, settled,
+		city->n_cnrs);
+	bench_compare(city, region, costs, vias, tree->cost, tree->via,
+		"region");
+}
+
+/* time packing the paths in tree into a field, report its size, and check
+   every corner of it, looked up in a shuffled order, against the costs
+   and vias */
+void bench_field(city_t *city, tree_t *tree, int runs, int *costs,
+	uint32_t *vias)
+{
+	int i;
+	uint32_t cnr = 0, step, period = 1;
+	clock_t start;
+	int whole[4] = {0, 0, city->x_dim - 1, city->y_dim - 1};
+	field_t *field = NULL;
+	int *field_costs = safe_malloc(city->n_cnrs * sizeof(int));
+	uint32_t *field_vias = safe_malloc(city->n_cnrs * sizeof(uint32_t));
+
+	start = clock();
+	for (i = 0; i < runs; i++)
+	{
+		free(field);
+		field = pack_field(city, tree, whole);
+	}
+	printf("B: field packing, %d runs, %.3f ms per run, %lu bytes, "
+		"%.2f per intersection\n", runs,
+		1000.0 * (clock() - start) / CLOCKS_PER_SEC / runs,
+		(unsigned long)field_size(field),
+		(double)field_size(field) / city->n_cnrs);
+
+	/* the lcg visits every number below its period once, so every corner
+	   once, skipping those past the last */
+	while (period < city->n_cnrs)
+	{
+		period *= 2;
+	}
+	start = clock();
+	for (step = 0; step < period; step++)
+	{
+		cnr = (cnr * LCG_MUL + LCG_INC) & (period - 1);
+		if (cnr < city->n_cnrs)
+		{
+			field_costs[cnr] = field_cost(field, cnr);
+			field_vias[cnr] = field_via(field, cnr);
+		}
+	}
+	printf("B: field lookups, %.3f us per intersection\n",
+		1e6 * (clock() - start) / CLOCKS_PER_SEC / city->n_cnrs);
+	bench_compare(city, NULL, costs, vias, field_costs, field_vias, "field");
+	free(field);
+	free(field_costs);
+	free(field_vias);
+}
+
+/* time finding the paths from the locations in the cache, given in
+   reverse so only their set matches, and check them against the costs and
+   vias found by searching */
+void bench_cache(city_t *city, vec_t *locs, tree_t *tree, opts_t *opts,
+	int *costs, uint32_t *vias)
+{
+	int i, runs = opts->bench_runs;
+	long hits = opts->cache->hits;
+	clock_t start;
+	uint32_t *rev = safe_malloc((locs->len + 1) * sizeof(uint32_t));
+	opts_t cache_opts = {.engine = ENGINE_DIAL};
+
+	cache_opts.cache = opts->cache;
+	for (i = 0; i < locs->len; i++)
+	{
+		rev[i] = locs->items[locs->len - 1 - i];
+	}
+	find_paths(city, locs->items, locs->len, &cache_opts, tree);
+	start = clock();
+	for (i = 0; i < runs; i++)
+	{
+		find_paths(city, rev, locs->len, &cache_opts, tree);
+	}
+	printf("B: cache lookups, %d runs, %.3f ms per run, %ld found\n", runs,
+		1000.0 * (clock() - start) / CLOCKS_PER_SEC / runs,
+		opts->cache->hits - hits);
+	bench_compare(city, NULL, costs, vias, tree->cost, tree->via, "cache");
+	free(rev);
+}
+
+/* time contraction hierarchy queries from the first location to each of
+   the others, and check they find the same routes as dial's engine */
+void bench_ch(city_t *city, vec_t *locs, tree_t *tree, ch_t *ch, int runs)
+{
+	int i, j, k, len, n = locs->len - 1, diff = -1, total = 0;
+	clock_t start;
+	char name[NAME_LEN];
+	chq_t *chq;
+	uint32_t *path, *ch_route;
+	int *costs;
+	opts_t opts = {.engine = ENGINE_DIAL};
+
+	if (n < 1)
+	{
+		return;
+	}
+	chq = new_chq(ch, tree->buckets);
+	path = safe_malloc(city->n_cnrs * sizeof(uint32_t));
+	ch_route = safe_malloc(city->n_cnrs * sizeof(uint32_t));
+	costs = safe_malloc(city->n_cnrs * sizeof(int));
+
+	/* point to point costs, each from scratch */
+	start = clock();
+	for (i = 0; i < runs; i++)
+	{
+		for (j = 1; j <= n; j++)
+		{
+			ch_source(ch, chq, locs->items[0]);
+			total += ch_cost(ch, chq, locs->items[j]);
+		}
+	}
+	printf("B: ch costs, %d queries, %.3f us per query (total %d)\n",
+		runs * n, 1e6 * (clock() - start) / CLOCKS_PER_SEC / runs / n,
+		total / runs);
+	/* routes, sharing the search from the first location */
+	start = clock();
+	for (i = 0; i < runs; i++)
+	{
+		ch_source(ch, chq, locs->items[0]);
+		for (j = 1; j <= n; j++)
+		{
+			ch_path(city, ch, chq, locs->items[j], tree, ch_route, 0);
+		}
+	}
+	printf("B: ch routes, %d queries, %.3f us per query\n",
+		runs * n, 1e6 * (clock() - start) / CLOCKS_PER_SEC / runs / n);
+
+	/* check against the stage 2 routes, costs and all */
+	for (j = 1; j <= n && diff < 0; j++)
+	{
+		find_paths(city, locs->items, 1, &opts, tree);
+		len = trace_path(city, tree, locs->items[j], path, 0);
+		for (k = 0; k < len; k++)
+		{
+			costs[k] = tree->cost[path[k]];
+		}
+		if (ch_path(city, ch, chq, locs->items[j], tree, ch_route, 0) != len)
+		{
+			diff = j;
+		}
+		for (k = 0; k < len && diff < 0; k++)
+		{
+			if (ch_route[k] != path[k] || tree->cost[path[k]] != costs[k])
+			{
+				diff = j;
+			}
+		}
+	}
+	if (diff >= 0)
+	{
+		printf("B: ch disagrees on the route to grid %s\n",
+			cnr_name(city, locs->items[diff], name));
+	}
+	else
+	{
+		printf("B: ch agrees on all %d routes\n", n);
+	}
+	free(path);
+	free(ch_route);
+	free(costs);
+	free_chq(chq);
+}
+
+/* time overlay searches from every location, then settling the whole city
+   from them, report its memory, and check against the costs and vias
+   found by the engines */
+void bench_overlay(city_t *city, vec_t *locs, tree_t *tree, overlay_t *ov,
+	int runs, int *costs, uint32_t *vias)
+{
+	int i, j, refined = 0;
+	clock_t start, settled = 0;
+	opts_t opts = {.engine = ENGINE_DIAL};
+
+	/* stage 2: routes from the first location, refining only the blocks
+	   they pass through */
+	opts.overlay = ov;
+	start = clock();
+	for (i = 0; i < runs; i++)
+	{
+		find_paths(city, locs->items, 1, &opts, tree);
+		for (j = 1; j < locs->len; j++)
+		{
+			ov_route(city, ov, tree, locs->items[j]);
+		}
+	}
+	for (i = 0; i < ov->x_blocks * ov->y_blocks; i++)
+	{
+		refined += ov->refined[i];
+	}
+	printf("B: overlay routes, %d runs, %.3f ms per run, %d of %d blocks "
+		"refined\n", runs, 1000.0 * (clock() - start) / CLOCKS_PER_SEC / runs,
+		refined, ov->x_blocks * ov->y_blocks);
+
+	/* stage 3: the whole city, from every location */
+	start = clock();
+	for (i = 0; i < runs; i++)
+	{
+		find_paths(city, locs->items, locs->len, &opts, tree);
+		settled -= clock();
+		ov_settle_all(city, ov, tree);
+		settled += clock();
+	}
+	printf("B: overlay, %d runs, %.3f ms per run, %.3f ms of it settling\n",
+		runs, 1000.0 * (clock() - start) / CLOCKS_PER_SEC / runs,
+		1000.0 * settled / CLOCKS_PER_SEC / runs);
+	printf("B: overlay of %dx%d blocks of side %d, %u boundary corners, "
+		"%lu bytes (%.1f%% of the city)\n", ov->x_blocks, ov->y_blocks,
+		ov->side, ov->first[ov->x_blocks * ov->y_blocks],
+		(unsigned long)overlay_size(city, ov),
+		100.0 * overlay_size(city, ov) / city_size(city));
+	bench_compare(city, NULL, costs, vias, tree->cost, tree->via, "overlay");
+}
+
+/* check the costs and vias found by what, eg. an overlay, against those
+   found by searching the whole city, at the corners of box, x0, y0, x1,
+   y1, or all of them if it is NULL, and report the first difference */
+void bench_compare(city_t *city, int *box, int *costs, uint32_t *vias,
+	int *what_costs, uint32_t *what_vias, char *what)
+{
+	uint32_t cnr, n = 0, diff = NO_CNR;
+	char name[NAME_LEN];
+
+	for (cnr = 0; cnr < city->n_cnrs && diff == NO_CNR; cnr++)
+	{
+		if (box && !in_region(city, box, cnr))
+		{
+			continue;
+		}
+		n++;
+		if (what_costs[cnr] != costs[cnr] || what_vias[cnr] != vias[cnr])
+		{
+			diff = cnr;
+		}
+	}
+	if (diff != NO_CNR)
+	{
+		printf("B: %s disagrees at grid %s\n", what,
+			cnr_name(city, diff, name));
+	}
+	else
+	{
+		printf("B: %s agrees on all %u intersections\n", what, n);
+	}
+}
+
+/* ~CH_T FUNCTIONS~ */
+/* build a contraction hierarchy of a city. corners are contracted in order
+   of how many shortcuts contracting them would add, less the streets it
+   removes, plus how many neighbours are already contracted, which spreads
+   contraction evenly over the city. priorities are updated lazily */
+ch_t* build_ch(city_t *city)
+{
+	int i, j, dir, key, n_up = 0, n_down = 0;
+	uint32_t v, cnr, *rank, *first_up, *first_down, n = city->n_cnrs;
+	uint32_t *up_mids, *down_mids;
+	node_t *cnrs = city_cnrs(city);
+	chb_t b;
+	int *prio = safe_malloc(n * sizeof(int));
+	heap_t order = {NULL, NULL, 0, 0};
+	edge_t *up, *down;
+	ch_t head, *ch;
+
+	b.out = safe_malloc(n * sizeof(elist_t));
+	b.in = safe_malloc(n * sizeof(elist_t));
+	b.done = safe_malloc(n);
+	b.depth = safe_malloc(n * sizeof(int));
+	b.dist = safe_malloc(n * sizeof(int));
+	b.seen = safe_malloc(n * sizeof(uint32_t));
+	b.search_id = 0;
+	b.search.items = NULL;
+	b.search.keys = NULL;
+	b.search.len = b.search.size = 0;
+	for (v = 0; v < n; v++)
+	{
+		b.out[v].items = b.in[v].items = NULL;
+		b.out[v].mids = b.in[v].mids = NULL;
+		b.out[v].len = b.in[v].len = b.out[v].size = b.in[v].size = 0;
+		b.done[v] = b.depth[v] = 0;
+		b.seen[v] = 0;
+	}
+	for (v = 0; v < n; v++)
+	{
+		for (dir = 0; dir < CARD_DIRS; dir++)
+		{
+			if ((cnr = cnrs[v].out[dir].to) != NO_CNR && cnr != v)
+			{
+				elist_add(cnr, cnrs[v].out[dir].weight, NO_CNR, &b.out[v]);
+				elist_add(v, cnrs[v].out[dir].weight, NO_CNR, &b.in[cnr]);
+			}
+		}
+	}
+	for (v = 0; v < n; v++)
+	{
+		heap_push(v, (prio[v] = contract(&b, v, 1)), &order);
+	}
+
+	/* rank[v] is the order v was contracted in */
+	rank = safe_malloc(n * sizeof(uint32_t));
+	for (i = 0; order.len; )
+	{
+		v = heap_pop(&order, &key);
+		if (b.done[v] || key != prio[v])
+		{
+			/* stale entry */
+			continue;
+		}
+		if (order.len && (prio[v] = contract(&b, v, 1)) > order.keys[0])
+		{
+			/* no longer the lowest, try again later */
+			heap_push(v, prio[v], &order);
+			continue;
+		}
+		contract(&b, v, 0);
+		b.done[v] = 1;
+		rank[v] = i++;
+		/* the remaining corners forget v, so searches never scan it */
+		for (j = 0; j < b.out[v].len; j++)
+		{
+			elist_remove(v, &b.in[b.out[v].items[j].to]);
+		}
+		for (j = 0; j < b.in[v].len; j++)
+		{
+			elist_remove(v, &b.out[b.in[v].items[j].to]);
+		}
+		/* the remaining neighbours now have another contracted neighbour,
+		   and maybe new shortcuts, which are only simulated once they
+		   reach the top of the heap again */
+		for (j = 0; j < b.out[v].len + b.in[v].len; j++)
+		{
+			cnr = (j < b.out[v].len) ? b.out[v].items[j].to :
+			                           b.in[v].items[j - b.out[v].len].to;
+			if (!b.done[cnr])
+			{
+				b.depth[cnr]++;
+				heap_push(cnr, ++prio[cnr], &order);
+			}
+		}
+	}
+
+	/* pack the streets and shortcuts to later contracted corners */
+	for (v = 0; v < n; v++)
+	{
+		for (i = 0; i < b.out[v].len; i++)
+		{
+			n_up += rank[b.out[v].items[i].to] > rank[v];
+		}
+		for (i = 0; i < b.in[v].len; i++)
+		{
+			n_down += rank[b.in[v].items[i].to] > rank[v];
+		}
+	}
+	head.n_cnrs = n;
+	head.n_up = n_up;
+	head.n_down = n_down;
+	ch = safe_malloc(ch_size(&head));
+	*ch = head;
+	first_up = ch_first(ch, 0);
+	first_down = ch_first(ch, 1);
+	up = ch_edges(ch, 0);
+	down = ch_edges(ch, 1);
+	up_mids = ch_mids(ch, 0);
+	down_mids = ch_mids(ch, 1);
+	for (v = 0, n_up = n_down = 0; v < n; v++)
+	{
+		first_up[v] = n_up;
+		first_down[v] = n_down;
+		for (i = 0; i < b.out[v].len; i++)
+		{
+			if (rank[b.out[v].items[i].to] > rank[v])
+			{
+				up_mids[n_up] = b.out[v].mids[i];
+				up[n_up++] = b.out[v].items[i];
+			}
+		}
+		for (i = 0; i < b.in[v].len; i++)
+		{
+			if (rank[b.in[v].items[i].to] > rank[v])
+			{
+				down_mids[n_down] = b.in[v].mids[i];
+				down[n_down++] = b.in[v].items[i];
+			}
+		}
+		free(b.out[v].items);
+		free(b.in[v].items);
+		free(b.out[v].mids);
+		free(b.in[v].mids);
+	}
+	first_up[n] = n_up;
+	first_down[n] = n_down;
+
+	free(b.out);
+	free(b.in);
+	free(b.done);
+	free(b.depth);
+	free(b.dist);
+	free(b.seen);
+	free(b.search.items);
+	free(b.search.keys);
+	free(prio);
+	free(rank);
+	free(order.items);
+	free(order.keys);
+	return ch;
+}
+
+/* contract corner v: for each pair of remaining neighbours u -> v -> w, add
+   a shortcut u -> w, through v, unless a witness search finds a path no
+   longer than it that avoids v. shortcuts of MAX_SECS or more are never needed, as no
+   route can cost that much. if simulate is set, nothing is added, and the
+   priority of contracting v is returned */
+int contract(chb_t *b, uint32_t v, int simulate)
+{
+	int i, j, k, limit, left, cost, settled, shortcuts = 0, removed = 0;
+	uint32_t u, w, cnr;
+	elist_t *out = b->out, *in = b->in;
+
+	for (i = 0; i < out[v].len; i++)
+	{
+		removed += !b->done[out[v].items[i].to];
+	}
+	for (i = 0; i < in[v].len; i++)
+	{
+		if (b->done[(u = in[v].items[i].to)])
+		{
+			continue;
+		}
+		removed++;
+		/* the longest shortcut from u that could be needed, and how many
+		   corners it could be needed to */
+		for (limit = -1, left = 0, j = 0; j < out[v].len; j++)
+		{
+			w = out[v].items[j].to;
+			cost = in[v].items[i].weight + out[v].items[j].weight;
+			if (!b->done[w] && w != u && cost < MAX_SECS)
+			{
+				limit = (cost > limit) ? cost : limit;
+				left++;
+			}
+		}
+		if (limit < 0)
+		{
+			continue;
+		}
+
+		/* witness search from u, up to limit, ignoring v, until all those
+		   corners are settled. corners are only in dist if seen by it */
+		b->done[v] = 1;
+		b->search.len = 0;
+		b->seen[u] = ++b->search_id;
+		b->dist[u] = 0;
+		heap_push(u, 0, &b->search);
+		for (settled = 0; left && b->search.len && settled < WITNESS_MAX; )
+		{
+			cnr = heap_pop(&b->search, &cost);
+			if (cost > b->dist[cnr])
+			{
+				continue;
+			}
+			if (cost > limit)
+			{
+				break;
+			}
+			settled++;
+			for (j = 0; j < out[v].len; j++)
+			{
+				left -= (out[v].items[j].to == cnr);
+			}
+			for (k = 0; k < out[cnr].len; k++)
+			{
+				w = out[cnr].items[k].to;
+				if (!b->done[w] && (b->seen[w] != b->search_id ||
+					cost + out[cnr].items[k].weight < b->dist[w]))
+				{
+					b->seen[w] = b->search_id;
+					b->dist[w] = cost + out[cnr].items[k].weight;
+					heap_push(w, b->dist[w], &b->search);
+				}
+			}
+		}
+		b->done[v] = 0;
+
+		for (j = 0; j < out[v].len; j++)
+		{
+			w = out[v].items[j].to;
+			cost = in[v].items[i].weight + out[v].items[j].weight;
+			if (b->done[w] || w == u || cost >= MAX_SECS ||
+				(b->seen[w] == b->search_id && b->dist[w] <= cost))
+			{
+				continue;
+			}
+			shortcuts++;
+			if (!simulate)
+			{
+				elist_add(w, cost, v, &out[u]);
+				elist_add(u, cost, v, &in[w]);
+			}
+		}
+	}
+	return shortcuts - removed + b->depth[v];
+}
+
+/* the first edge offsets of a contraction hierarchy, up or down ones */
+uint32_t* ch_first(ch_t *ch, int down)
+{
+	return (uint32_t*)(ch + 1) + (down ? ch->n_cnrs + 1 : 0);
+}
+
+/* the edges of a contraction hierarchy, up or down ones */
+edge_t* ch_edges(ch_t *ch, int down)
+{
+	return (edge_t*)(ch_first(ch, 1) + ch->n_cnrs + 1) +
+		(down ? ch->n_up : 0);
+}
+
+/* the corners skipped by the edges of a contraction hierarchy, up or down
+   ones, in the same order as ch_edges */
+uint32_t* ch_mids(ch_t *ch, int down)
+{
+	return (uint32_t*)(ch_edges(ch, 1) + ch->n_down) + (down ? ch->n_up : 0);
+}
+
+/* the number of bytes in a contraction hierarchy block */
+size_t ch_size(ch_t *ch)
+{
+	return sizeof(ch_t) + 2 * (ch->n_cnrs + 1) * sizeof(uint32_t)
+		+ (ch->n_up + ch->n_down) * (sizeof(edge_t) + sizeof(uint32_t));
+}
+
+/* malloc and initialise scratch for queries of a contraction hierarchy,
+   which use the queue buckets, eg. those of a tree */
+chq_t* new_chq(ch_t *ch, vec_t *buckets)
+{
+	uint32_t i;
+	chq_t *chq = safe_malloc(sizeof(chq_t));
+
+	chq->source = NO_CNR;
+	chq->fwd = safe_malloc(ch->n_cnrs * sizeof(int));
+	chq->bwd = safe_malloc(ch->n_cnrs * sizeof(int));
+	chq->cost = safe_malloc(ch->n_cnrs * sizeof(int));
+	chq->fwd_at = safe_malloc(ch->n_cnrs * sizeof(uint32_t));
+	chq->bwd_at = safe_malloc(ch->n_cnrs * sizeof(uint32_t));
+	chq->cost_at = safe_malloc(ch->n_cnrs * sizeof(uint32_t));
+	chq->fwd_via = safe_malloc(ch->n_cnrs * sizeof(uint32_t));
+	chq->bwd_via = safe_malloc(ch->n_cnrs * sizeof(uint32_t));
+	for (i = 0; i < ch->n_cnrs; i++)
+	{
+		chq->fwd_at[i] = chq->bwd_at[i] = chq->cost_at[i] = 0;
+	}
+	chq->fwd_id = chq->bwd_id = 0;
+	chq->meet = NO_CNR;
+	chq->buckets = buckets;
+	return chq;
+}
+
+void free_chq(chq_t *chq)
+{
+	free(chq->fwd);
+	free(chq->bwd);
+	free(chq->cost);
+	free(chq->fwd_at);
+	free(chq->bwd_at);
+	free(chq->cost_at);
+	free(chq->fwd_via);
+	free(chq->bwd_via);
+	free(chq);
+}
+
+/* start queries from source: search up from it to every corner it can
+   reach for less than MAX_SECS */
+void ch_source(ch_t *ch, chq_t *chq, uint32_t source)
+{
+	chq->source = source;
+	/* a new id also forgets the costs found from the last source */
+	ch_search(ch, chq, 0, source, MAX_SECS);
+}
+
+/* return the cost of the shortest path from the source to cnr, or
+   MAX_SECS if there isn't one: the lowest sum of costs in the forward
+   search and a backward search from cnr, where they meet */
+int ch_cost(ch_t *ch, chq_t *chq, uint32_t cnr)
+{
+	if (chq->cost_at[cnr] != chq->fwd_id)
+	{
+		chq->cost_at[cnr] = chq->fwd_id;
+		chq->cost[cnr] = ch_search(ch, chq, 1, cnr, MAX_SECS);
+	}
+	return chq->cost[cnr];
+}
+
+/* dial's algorithm up the hierarchy from cnr, along up edges, or if
+   backward, along down edges. a backward search stops once it can't
+   improve on the best meeting with the forward search, which it returns,
+   keeping where it was in chq->meet */
+int ch_search(ch_t *ch, chq_t *chq, int backward, uint32_t cnr, int best)
+{
+	int cost = 0, pending = 1, new_cost;
+	uint32_t i, cur, *first = ch_first(ch, backward);
+	edge_t *edges = ch_edges(ch, backward);
+	int *dist = backward ? chq->bwd : chq->fwd;
+	uint32_t *at = backward ? chq->bwd_at : chq->fwd_at;
+	uint32_t *via = backward ? chq->bwd_via : chq->fwd_via;
+	uint32_t id = backward ? ++chq->bwd_id : ++chq->fwd_id;
+	vec_t *bucket;
+
+	at[cnr] = id;
+	dist[cnr] = 0;
+	via[cnr] = NO_CNR;
+	chq->meet = NO_CNR;
+	vec_push(cnr, &chq->buckets[0]);
+	while (pending)
+	{
+		while (!(bucket = &chq->buckets[cost % BUCKETS])->len)
+		{
+			cost++;
+		}
+		if (backward && cost >= best)
+		{
+			break;
+		}
+		cur = bucket->items[--bucket->len];
+		pending--;
+		if (dist[cur] != cost)
+		{
+			continue;
+		}
+		if (backward && chq->fwd_at[cur] == chq->fwd_id &&
+			cost + chq->fwd[cur] < best)
+		{
+			best = cost + chq->fwd[cur];
+			chq->meet = cur;
+		}
+		for (i = first[cur]; i < first[cur + 1]; i++)
+		{
+			new_cost = cost + edges[i].weight;
+			if (new_cost < MAX_SECS && (at[edges[i].to] != id ||
+				new_cost < dist[edges[i].to]))
+			{
+				at[edges[i].to] = id;
+				dist[edges[i].to] = new_cost;
+				via[edges[i].to] = cur;
+				vec_push(edges[i].to, &chq->buckets[new_cost % BUCKETS]);
+				pending++;
+			}
+		}
+	}
+	/* empty any buckets left by stopping early */
+	for (i = 0; pending && i < BUCKETS; i++)
+	{
+		pending -= chq->buckets[i].len;
+		chq->buckets[i].len = 0;
+	}
+	return best;
+}
+
+/* write the route from the source to end into path, as corners, with
+   their costs in tree, and return its length, as trace_path would after
+   find_paths from the source. the shortcuts of the searches are unpacked
+   into a route of the same cost, which is then walked back from end,
+   keeping the via find_paths would choose at each corner, so routes of
+   equal cost are broken the same way. only neighbours that would win a
+   tie against the route's via need their costs found */
+int ch_path(city_t *city, ch_t *ch, chq_t *chq, uint32_t end, tree_t *tree,
+	uint32_t *path, int turns)
+{
+	int i, dir, len, weight, via_weight, *cost = tree->cost;
+	uint32_t cnr, prev, via, tmp;
+	node_t *cnrs = city_cnrs(city);
+
+	if (end == chq->source || ch_cost(ch, chq, end) >= MAX_SECS)
+	{
+		return 0;
+	}
+	tree->states = 1;
+	len = ch_route(ch, chq, end, path, city->n_cnrs, cost);
+	for (i = 0; i + 1 < len; i++)
+	{
+		cnr = path[i];
+		via = path[i + 1];
+		via_weight = cost[cnr] - cost[via];
+		for (dir = 0; dir < CARD_DIRS; dir++)
+		{
+			if ((prev = neighbour(city, cnr, dir)) == NO_CNR || prev == via ||
+				cnrs[prev].out[(dir + 2) % CARD_DIRS].to != cnr)
+			{
+				continue;
+			}
+			/* ties are broken as in cost_via. the corner after cnr on the
+			   route already has its cost */
+			weight = cnrs[prev].out[(dir + 2) % CARD_DIRS].weight;
+			if (((weight && !via_weight) ||
+				(!weight == !via_weight && lex_lower(city, prev, via))) &&
+				((i && prev == path[i - 1]) ? cost[prev] :
+				 ch_cost(ch, chq, prev)) + weight == cost[cnr])
+			{
+				via = prev;
+				via_weight = weight;
+			}
+		}
+		if (via != path[i + 1])
+		{
+			/* the rest of the route is to the better via instead */
+			len = i + 1 + ch_route(ch, chq, via, path + i + 1,
+				city->n_cnrs - i - 1, cost);
+		}
+	}
+	/* reverse the route, to run from the start */
+	for (i = 0; i < len / 2; i++)
+	{
+		tmp = path[i];
+		path[i] = path[len - 1 - i];
+		path[len - 1 - i] = tmp;
+	}
+	return turns ? turns_only(city, path, len, 1) : len;
+}
+
+/* write the route from the source to cnr, which must be reachable, into
+   path, backwards, as corners, with their costs in cost, and return its
+   length. it goes up the forward search to where it meets a backward
+   search from cnr, then down that, unpacking each shortcut on the way.
+   no more than room corners are written */
+int ch_route(ch_t *ch, chq_t *chq, uint32_t cnr, uint32_t *path, int room,
+	int *cost)
+{
+	int i, len;
+	uint32_t at, tmp;
+
+	ch_search(ch, chq, 1, cnr, MAX_SECS);
+	if (chq->meet == NO_CNR)
+	{
+		return 0;
+	}
+	cost[chq->source] = 0;
+	len = ch_route_up(ch, chq, chq->meet, path, 0, room, cost);
+	for (at = chq->meet; at != cnr; at = chq->bwd_via[at])
+	{
+		len = ch_unpack(ch, at, chq->bwd_via[at], path, len, room, cost);
+	}
+	for (i = 0; i < len / 2; i++)
+	{
+		tmp = path[i];
+		path[i] = path[len - 1 - i];
+		path[len - 1 - i] = tmp;
+	}
+	return len;
+}
+
+/* add the route from the source up the forward search to cnr to path,
+   which is len corners long, and return its new length */
+int ch_route_up(ch_t *ch, chq_t *chq, uint32_t cnr, uint32_t *path, int len,
+	int room, int *cost)
+{
+	if (cnr == chq->source)
+	{
+		if (len < room)
+		{
+			path[len++] = cnr;
+		}
+		return len;
+	}
+	len = ch_route_up(ch, chq, chq->fwd_via[cnr], path, len, room, cost);
+	return ch_unpack(ch, chq->fwd_via[cnr], cnr, path, len, room, cost);
+}
+
+/* add the streets of the edge from u to w, whose cost is in cost, to
+   path, which is len corners long and ends at u, and return its new
+   length. a shortcut is the two edges through the corner it skips, which
+   was contracted before either end, so those edges are an up edge of it
+   and a down edge into it */
+int ch_unpack(ch_t *ch, uint32_t u, uint32_t w, uint32_t *path, int len,
+	int room, int *cost)
+{
+	uint32_t i, last, *first = ch_first(ch, 0), *mids = ch_mids(ch, 0);
+	edge_t *edges = ch_edges(ch, 0);
+
+	/* an up edge from u, else a down edge into w, after the up edges */
+	i = first[u];
+	while (i < first[u + 1] && edges[i].to != w)
+	{
+		i++;
+	}
+	if (i == first[u + 1])
+	{
+		first = ch_first(ch, 1);
+		i = ch->n_up + first[w];
+		last = ch->n_up + first[w + 1];
+		while (i < last && edges[i].to != u)
+		{
+			i++;
+		}
+		if (i == last)
+		{
+			return len;
+		}
+	}
+	if (mids[i] != NO_CNR)
+	{
+		len = ch_unpack(ch, u, mids[i], path, len, room, cost);
+		return ch_unpack(ch, mids[i], w, path, len, room, cost);
+	}
+	if (len < room)
+	{
+		cost[w] = cost[u] + edges[i].weight;
+		path[len++] = w;
+	}
+	return len;
+}
+
+/* ~OVERLAY_T FUNCTIONS~ */
+/* build an overlay of a city, with blocks of side by side corners */
+overlay_t* build_overlay(city_t *city, int side)
+{
+	int i, j, k, dir, x, y, n_bnd = 0, n_cost = 0, box[4];
+	uint32_t cnr, next, block, n_blocks;
+	node_t *cnrs = city_cnrs(city);
+	overlay_t *ov = safe_malloc(sizeof(overlay_t));
+	int *dist = safe_malloc(city->n_cnrs * sizeof(int));
+	short *row;
+
+	ov->side = side;
+	ov->x_blocks = (city->x_dim + side - 1) / side;
+	ov->y_blocks = (city->y_dim + side - 1) / side;
+	n_blocks = ov->x_blocks * ov->y_blocks;
+	ov->first = safe_malloc((n_blocks + 1) * sizeof(uint32_t));
+	ov->first_cost = safe_malloc((n_blocks + 1) * sizeof(uint32_t));
+	ov->bnd = safe_malloc(city->n_cnrs * sizeof(uint32_t));
+	ov->slot = safe_malloc(city->n_cnrs * sizeof(uint32_t));
+	ov->refined = safe_malloc(n_blocks);
+	ov->starts = NULL;
+	ov->n_starts = 0;
+	ov->buckets = new_buckets();
+
+	/* find the boundary corners of each block, in order */
+	for (block = 0; block < n_blocks; block++)
+	{
+		ov->first[block] = n_bnd;
+		ov->first_cost[block] = n_cost;
+		ov_box(city, ov, block, box);
+		for (y = box[1]; y <= box[3]; y++)
+		{
+			for (x = box[0]; x <= box[2]; x++)
+			{
+				cnr = y * city->x_dim + x;
+				ov->slot[cnr] = NO_CNR;
+				dist[cnr] = MAX_SECS;
+				for (dir = 0; dir < CARD_DIRS; dir++)
+				{
+					if ((next = neighbour(city, cnr, dir)) != NO_CNR &&
+						ov_block(city, ov, next) != block &&
+						(cnrs[cnr].out[dir].to == next ||
+						 cnrs[next].out[(dir + 2) % CARD_DIRS].to == cnr))
+					{
+						ov->slot[cnr] = n_bnd - ov->first[block];
+						ov->bnd[n_bnd++] = cnr;
+						break;
+					}
+				}
+			}
+		}
+		k = n_bnd - ov->first[block];
+		n_cost += k * k;
+	}
+	ov->first[n_blocks] = n_bnd;
+	ov->first_cost[n_blocks] = n_cost;
+	ov->bnd = safe_realloc(ov->bnd, (n_bnd ? n_bnd : 1) * sizeof(uint32_t));
+
+	/* the cost from each boundary corner to each other, within its block */
+	ov->cost = safe_malloc((n_cost ? n_cost : 1) * sizeof(short));
+	for (block = 0; block < n_blocks; block++)
+	{
+		k = ov->first[block + 1] - ov->first[block];
+		for (i = 0; i < k; i++)
+		{
+			dist[ov->bnd[ov->first[block] + i]] = 0;
+			ov_local(city, ov, block, dist);
+			row = ov->cost + ov->first_cost[block] + i * k;
+			for (j = 0; j < k; j++)
+			{
+				row[j] = dist[ov->bnd[ov->first[block] + j]];
+			}
+			/* reset the block for the next search */
+			ov_box(city, ov, block, box);
+			for (y = box[1]; y <= box[3]; y++)
+			{
+				for (x = box[0]; x <= box[2]; x++)
+				{
+					dist[y * city->x_dim + x] = MAX_SECS;
+				}
+			}
+		}
+	}
+	free(dist);
+	return ov;
+}
+
+void free_overlay(overlay_t *ov)
+{
+	free_buckets(ov->buckets);
+	free(ov->first);
+	free(ov->first_cost);
+	free(ov->bnd);
+	free(ov->slot);
+	free(ov->cost);
+	free(ov->refined);
+	free(ov);
+}
+
+/* the number of bytes an overlay adds to its city, not counting the
+   queue it shares with its searches */
+size_t overlay_size(city_t *city, overlay_t *ov)
+{
+	uint32_t n_blocks = ov->x_blocks * ov->y_blocks;
+
+	return sizeof(overlay_t) + n_blocks
+		+ (2 * (n_blocks + 1) + ov->first[n_blocks] + city->n_cnrs)
+		* sizeof(uint32_t) + ov->first_cost[n_blocks] * sizeof(short);
+}
+
+/* the block a corner is in */
+uint32_t ov_block(city_t *city, overlay_t *ov, uint32_t cnr)
+{
+	return (cnr / city->x_dim / ov->side) * ov->x_blocks +
+		cnr % city->x_dim / ov->side;
+}
+
+/* the corners of a block, x0, y0, x1, y1, into box. blocks on the right
+   and bottom edges of the city may be smaller */
+void ov_box(city_t *city, overlay_t *ov, uint32_t block, int *box)
+{
+	int x = block % ov->x_blocks, y = block / ov->x_blocks;
+
+	box[0] = x * ov->side;
+	box[1] = y * ov->side;
+	box[2] = ((x + 1) * ov->side < city->x_dim) ?
+		(x + 1) * ov->side - 1 : city->x_dim - 1;
+	box[3] = ((y + 1) * ov->side < city->y_dim) ?
+		(y + 1) * ov->side - 1 : city->y_dim - 1;
+}
+
+/* lower the cost of a corner to new_cost, if that's lower, and queue it,
+   returning 1 if it was */
+int ov_lower(overlay_t *ov, int *cost, uint32_t cnr, int new_cost)
+{
+	if (new_cost >= cost[cnr])
+	{
+		return 0;
+	}
+	cost[cnr] = new_cost;
+	vec_push(cnr, &ov->buckets[new_cost % BUCKETS]);
+	return 1;
+}
+
+/* dial's algorithm within a block, from each of its corners with a cost,
+   using only streets inside the block */
+void ov_local(city_t *city, overlay_t *ov, uint32_t block, int *cost)
+{
+	int dir, x, y, c = MAX_SECS, pending = 0, box[4];
+	uint32_t cur, to;
+	node_t *cnrs = city_cnrs(city);
+	vec_t *bucket;
+
+	ov_box(city, ov, block, box);
+	for (y = box[1]; y <= box[3]; y++)
+	{
+		for (x = box[0]; x <= box[2]; x++)
+		{
+			cur = y * city->x_dim + x;
+			if (cost[cur] < MAX_SECS)
+			{
+				vec_push(cur, &ov->buckets[cost[cur] % BUCKETS]);
+				pending++;
+				c = (cost[cur] < c) ? cost[cur] : c;
+			}
+		}
+	}
+	while (pending)
+	{
+		while (!(bucket = &ov->buckets[c % BUCKETS])->len)
+		{
+			c++;
+		}
+		cur = bucket->items[--bucket->len];
+		pending--;
+		if (cost[cur] != c)
+		{
+			continue;
+		}
+		for (dir = 0; dir < CARD_DIRS; dir++)
+		{
+			if ((to = cnrs[cur].out[dir].to) != NO_CNR &&
+				ov_block(city, ov, to) == block)
+			{
+				pending += ov_lower(ov, cost, to, c + cnrs[cur].out[dir].weight);
+			}
+		}
+	}
+}
+
+/* settle the corners of a block from the costs of its boundary corners,
+   if it isn't already */
+void ov_refine(city_t *city, overlay_t *ov, tree_t *tree, uint32_t block)
+{
+	if (!ov->refined[block])
+	{
+		ov_local(city, ov, block, tree->cost);
+		ov->refined[block] = 1;
+	}
+}
+
+/* search the overlay from the given starts, for the costs of every
+   boundary corner. the blocks of the starts are searched in full, so are
+   already refined, but other blocks are only crossed by their costs
+   between boundary corners. vias are left for ov_route and ov_settle_all,
+   which derive them from the costs */
+void find_paths_overlay(city_t *city, overlay_t *ov, uint32_t *starts,
+	int n_starts, tree_t *tree)
+{
+	int i, k, dir, cost = 0, pending = 0;
+	uint32_t cur, to, block, *bnd;
+	node_t *cnrs = city_cnrs(city);
+	vec_t *bucket;
+	short *row;
+
+	for (i = 0; i < ov->x_blocks * ov->y_blocks; i++)
+	{
+		ov->refined[i] = 0;
+	}
+	ov->starts = starts;
+	ov->n_starts = n_starts;
+	for (i = 0; i < n_starts; i++)
+	{
+		ov->refined[ov_block(city, ov, starts[i])] = 1;
+		vec_push(starts[i], &ov->buckets[0]);
+		pending++;
+	}
+	while (pending)
+	{
+		while (!(bucket = &ov->buckets[cost % BUCKETS])->len)
+		{
+			cost++;
+		}
+		cur = bucket->items[--bucket->len];
+		pending--;
+		if (tree->cost[cur] != cost)
+		{
+			continue;
+		}
+		block = ov_block(city, ov, cur);
+		for (dir = 0; dir < CARD_DIRS; dir++)
+		{
+			/* in other blocks, only streets leaving the block */
+			if ((to = cnrs[cur].out[dir].to) != NO_CNR &&
+				(ov->refined[block] || ov_block(city, ov, to) != block))
+			{
+				pending += ov_lower(ov, tree->cost, to,
+					cost + cnrs[cur].out[dir].weight);
+			}
+		}
+		if (!ov->refined[block] && ov->slot[cur] != NO_CNR)
+		{
+			/* across the block, to its other boundary corners */
+			k = ov->first[block + 1] - ov->first[block];
+			bnd = ov->bnd + ov->first[block];
+			row = ov->cost + ov->first_cost[block] + ov->slot[cur] * k;
+			for (i = 0; i < k; i++)
+			{
+				if (row[i] < MAX_SECS && cost + row[i] < MAX_SECS)
+				{
+					pending += ov_lower(ov, tree->cost, bnd[i], cost + row[i]);
+				}
+			}
+		}
+	}
+}
+
+/* return whether cnr is one of the starts of the last overlay search */
+int ov_is_start(overlay_t *ov, uint32_t cnr)
+{
+	int i;
+
+	for (i = 0; i < ov->n_starts; i++)
+	{
+		if (ov->starts[i] == cnr)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* set the vias back along the route to end, refining the blocks of it and
+   its neighbours, so trace_path can follow it. stops at a start, or a
+   corner whose via is already set */
+void ov_route(city_t *city, overlay_t *ov, tree_t *tree, uint32_t end)
+{
+	int dir;
+	uint32_t cnr = end, prev;
+
+	while (tree->via[cnr] == NO_CNR && !ov_is_start(ov, cnr))
+	{
+		ov_refine(city, ov, tree, ov_block(city, ov, cnr));
+		for (dir = 0; dir < CARD_DIRS; dir++)
+		{
+			if ((prev = neighbour(city, cnr, dir)) != NO_CNR)
+			{
+				ov_refine(city, ov, tree, ov_block(city, ov, prev));
+			}
+		}
+		if ((tree->via[cnr] = cost_via(city, tree->cost, cnr)) == NO_CNR)
+		{
+			/* not reachable */
+			return;
+		}
+		cnr = tree->via[cnr];
+	}
+}
+
+/* refine every block, and set the via of every corner */
+void ov_settle_all(city_t *city, overlay_t *ov, tree_t *tree)
+{
+	uint32_t i, n_blocks = ov->x_blocks * ov->y_blocks;
+
+	for (i = 0; i < n_blocks; i++)
+	{
+		ov_refine(city, ov, tree, i);
+	}
+	for (i = 0; i < city->n_cnrs; i++)
+	{
+		tree->via[i] = ov_is_start(ov, i) ? NO_CNR :
+			cost_via(city, tree->cost, i);
+	}
+}
+
+/* ~PAGER_T FUNCTIONS~ */
+/* make a pager for the corners of city, in fp, with the bands and number
+   of them to cache given in opts */
+pager_t* new_pager(FILE *fp, city_t *city, opts_t *opts)
+{
+	int i;
+	pager_t *pager = safe_malloc(sizeof(pager_t));
+
+	pager->fp = fp;
+	pager->n_cnrs = city->n_cnrs;
+	pager->band_cnrs = opts->band_cnrs ? opts->band_cnrs :
+		opts->band_rows * city->x_dim;
+	if (pager->band_cnrs > city->n_cnrs)
+	{
+		pager->band_cnrs = city->n_cnrs;
+	}
+	pager->n_bands = (city->n_cnrs + pager->band_cnrs - 1) / pager->band_cnrs;
+	pager->n_frames = (opts->pages < pager->n_bands) ? opts->pages :
+		pager->n_bands;
+	pager->used = 0;
+	pager->frames = safe_malloc(pager->n_frames * pager->band_cnrs
+		* sizeof(node_t));
+	pager->band_of = safe_malloc(pager->n_frames * sizeof(int));
+	pager->dirty = safe_malloc(pager->n_frames);
+	pager->newer = safe_malloc(pager->n_frames * sizeof(int));
+	pager->older = safe_malloc(pager->n_frames * sizeof(int));
+	pager->frame_of = safe_malloc(pager->n_bands * sizeof(int));
+	for (i = 0; i < pager->n_bands; i++)
+	{
+		pager->frame_of[i] = -1;
+	}
+	pager->newest = pager->oldest = -1;
+	pager->hits = pager->faults = pager->evictions = 0;
+	pager->bytes_read = pager->bytes_written = 0;
+	return pager;
+}
+
+/* write back the changed bands, and close the file */
+void free_pager(pager_t *pager)
+{
+	pager_flush(pager);
+	fclose(pager->fp);
+	free(pager->frames);
+	free(pager->band_of);
+	free(pager->dirty);
+	free(pager->newer);
+	free(pager->older);
+	free(pager->frame_of);
+	free(pager);
+}
+
+/* return a corner, reading its band in if needed. if write is set, the
+   band is written back before it is evicted. the corner is only valid
+   until the next call */
+node_t* pager_cnr(pager_t *pager, uint32_t cnr, int write)
+{
+	int band = cnr / pager->band_cnrs, frame = pager->frame_of[band];
+
+	if (frame >= 0)
+	{
+		pager->hits++;
+		if (frame != pager->newest)
+		{
+			/* unlink it, to move it to the front */
+			if (pager->older[frame] >= 0)
+			{
+				pager->newer[pager->older[frame]] = pager->newer[frame];
+			}
+			else
+			{
+				pager->oldest = pager->newer[frame];
+			}
+			pager->older[pager->newer[frame]] = pager->older[frame];
+		}
+	}
+	else
+	{
+		pager->faults++;
+		if (pager->used < pager->n_frames)
+		{
+			frame = pager->used++;
+		}
+		else
+		{
+			/* evict the least recently used band */
+			frame = pager->oldest;
+			pager->evictions++;
+			if (pager->dirty[frame])
+			{
+				pager_io(pager, frame, 1);
+			}
+			pager->frame_of[pager->band_of[frame]] = -1;
+			if ((pager->oldest = pager->newer[frame]) >= 0)
+			{
+				pager->older[pager->oldest] = -1;
+			}
+			else
+			{
+				pager->newest = -1;
+			}
+		}
+		pager->band_of[frame] = band;
+		pager->frame_of[band] = frame;
+		pager->dirty[frame] = 0;
+		pager_io(pager, frame, 0);
+	}
+	if (frame != pager->newest)
+	{
+		/* link it in as the newest */
+		pager->older[frame] = pager->newest;
+		pager->newer[frame] = -1;
+		if (pager->newest >= 0)
+		{
+			pager->newer[pager->newest] = frame;
+		}
+		else
+		{
+			pager->oldest = frame;
+		}
+		pager->newest = frame;
+	}
+	pager->dirty[frame] |= write;
+	return &pager->frames[frame * pager->band_cnrs + cnr % pager->band_cnrs];
+}
+
+/* read the band of a frame into it, or write it back */
+void pager_io(pager_t *pager, int frame, int write)
+{
+	int band = pager->band_of[frame];
+	uint32_t n = pager->band_cnrs;
+	node_t *cnrs = &pager->frames[frame * pager->band_cnrs];
+
+	/* the last band may be short */
+	if (band == pager->n_bands - 1)
+	{
+		n = pager->n_cnrs - band * pager->band_cnrs;
+	}
+	if (fseek(pager->fp, sizeof(city_t) + (long)band * pager->band_cnrs
+		* sizeof(node_t), SEEK_SET) || (write ?
+		fwrite(cnrs, sizeof(node_t), n, pager->fp) :
+		fread(cnrs, sizeof(node_t), n, pager->fp)) != n)
+	{
+		perror("pager");
+		exit(EXIT_FAILURE);
+	}
+	if (write)
+	{
+		pager->bytes_written += n * sizeof(node_t);
+		pager->dirty[frame] = 0;
+	}
+	else
+	{
+		pager->bytes_read += n * sizeof(node_t);
+	}
+}
+
+/* write back every changed band */
+void pager_flush(pager_t *pager)
+{
+	int i;
+
+	for (i = 0; i < pager->used; i++)
+	{
+		if (pager->dirty[i])
+		{
+			pager_io(pager, i, 1);
+		}
+	}
+}
+
+void print_pager(pager_t *pager, FILE *fp)
+{
+	long lookups = pager->hits + pager->faults;
+
+	fprintf(fp, "M: %ld lookups, %ld page faults (%.2f%%), %ld evictions\n",
+		lookups, pager->faults, lookups ? 100.0 * pager->faults / lookups : 0,
+		pager->evictions);
+	fprintf(fp, "M: read %lu bytes, wrote %lu bytes, %d of %d bands of %u "
+		"corners resident, %lu bytes\n", pager->bytes_read,
+		pager->bytes_written, pager->used, pager->n_bands, pager->band_cnrs,
+		(unsigned long)pager->used * pager->band_cnrs * sizeof(node_t));
+}
+
+/* ~CACHE_T FUNCTIONS~ */
+/* return a new, empty cache of n_slots entries */
+cache_t* new_cache(int n_slots)
+{
+	cache_t *cache = safe_malloc(sizeof(cache_t));
+
+	cache->n_slots = n_slots;
+	cache->used = 0;
+	cache->version = 0;
+	cache->key = safe_malloc(n_slots * sizeof(uint32_t*));
+	cache->key_len = safe_malloc(n_slots * sizeof(int));
+	cache->field = safe_malloc(n_slots * sizeof(field_t*));
+	cache->last_use = safe_malloc(n_slots * sizeof(long));
+	cache->uses = cache->hits = cache->misses = cache->evictions = 0;
+	cache->bytes = 0;
+	return cache;
+}
+
+void free_cache(cache_t *cache)
+{
+	int i;
+
+	for (i = 0; i < cache->used; i++)
+	{
+		free(cache->key[i]);
+		free(cache->field[i]);
+	}
+	free(cache->key);
+	free(cache->key_len);
+	free(cache->field);
+	free(cache->last_use);
+	free(cache);
+}
+
+/* write the key of a set of starts into key: sorted, without repeats, and
+   return its length */
+int cache_key(uint32_t *starts, int n_starts, uint32_t *key)
+{
+	int i, len = 0;
+
+	memcpy(key, starts, n_starts * sizeof(uint32_t));
+	qsort(key, n_starts, sizeof(uint32_t), cmp_cnr);
+	for (i = 0; i < n_starts; i++)
+	{
+		if (!len || key[len - 1] != key[i])
+		{
+			key[len++] = key[i];
+		}
+	}
+	return len;
+}
+
+int cmp_cnr(const void *a, const void *b)
+{
+	uint32_t x = *(uint32_t*)a, y = *(uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+/* look a key up, and if it is there, fill tree with its paths and return
+   1, else return 0. entries from an older version of the city are dropped
+   first. there are few entries, so they are searched in turn */
+int cache_find(cache_t *cache, city_t *city, uint32_t *key, int len,
+	tree_t *tree)
+{
+	int i;
+
+	if (cache->version != city->version)
+	{
+		for (i = 0; i < cache->used; i++)
+		{
+			free(cache->key[i]);
+			free(cache->field[i]);
+		}
+		cache->used = 0;
+		cache->bytes = 0;
+		cache->version = city->version;
+	}
+	for (i = 0; i < cache->used; i++)
+	{
+		if (cache->key_len[i] == len &&
+			!memcmp(cache->key[i], key, len * sizeof(uint32_t)))
+		{
+			break;
+		}
+	}
+	if (i == cache->used)
+	{
+		cache->misses++;
+		return 0;
+	}
+	cache->hits++;
+	cache->last_use[i] = ++cache->uses;
+	unpack_field(cache->field[i], tree);
+	return 1;
+}
+
+/* add the paths in tree, from the starts of key, to the cache, replacing
+   the least recently used entry if it is full */
+void cache_add(cache_t *cache, city_t *city, uint32_t *key, int len,
+	tree_t *tree)
+{
+	int i, slot = 0;
+	int whole[4] = {0, 0, city->x_dim - 1, city->y_dim - 1};
+
+	if (cache->used < cache->n_slots)
+	{
+		slot = cache->used++;
+		cache->key[slot] = NULL;
+	}
+	else
+	{
+		for (i = 1; i < cache->used; i++)
+		{
+			if (cache->last_use[i] < cache->last_use[slot])
+			{
+				slot = i;
+			}
+		}
+		cache->evictions++;
+		cache->bytes -= field_size(cache->field[slot]) +
+			cache->key_len[slot] * sizeof(uint32_t);
+		free(cache->field[slot]);
+	}
+	cache->key[slot] = safe_realloc(cache->key[slot],
+		(len + 1) * sizeof(uint32_t));
+	memcpy(cache->key[slot], key, len * sizeof(uint32_t));
+	cache->key_len[slot] = len;
+	cache->last_use[slot] = ++cache->uses;
+	cache->field[slot] = pack_field(city, tree, whole);
+	cache->bytes += field_size(cache->field[slot]) + len * sizeof(uint32_t);
+}
+
+void print_cache(cache_t *cache, FILE *fp)
+{
+	long finds = cache->hits + cache->misses;
+
+	fprintf(fp, "Q: %ld searches, %ld found in the cache (%.2f%%), "
+		"%ld evictions\n", finds, cache->hits,
+		finds ? 100.0 * cache->hits / finds : 0, cache->evictions);
+	fprintf(fp, "Q: %d of %d entries used, %lu bytes\n", cache->used,
+		cache->n_slots, cache->bytes);
+}
+
+/* ~FIELD_T FUNCTIONS~ */
+/* pack the costs and vias of the best paths in tree to the corners of box,
+   x0, y0, x1, y1, into a new field */
+field_t* pack_field(city_t *city, tree_t *tree, int *box)
+{
+	int x, y, dir, cost, prev = 0, delta;
+	uint32_t i = 0, cnr, via, zigzag, *runs;
+	field_t head, *field;
+	vec_t none = {NULL, 0, 0};
+	unsigned char *dirs, *bytes, *b;
+
+	head.x_dim = city->x_dim;
+	memcpy(head.box, box, sizeof(head.box));
+	head.n_cnrs = (box[2] - box[0] + 1) * (box[3] - box[1] + 1);
+	head.n_runs = (head.n_cnrs + FIELD_RUN - 1) / FIELD_RUN;
+	/* each part is packed into scratch, then copied to the field once
+	   their sizes are known */
+	runs = safe_malloc((head.n_runs + 1) * sizeof(uint32_t));
+	dirs = safe_malloc((head.n_cnrs + 3) / 4 + 1);
+	memset(dirs, 0, (head.n_cnrs + 3) / 4 + 1);
+	b = bytes = safe_malloc(head.n_cnrs * VARINT_MAX + 1);
+	for (y = box[1]; y <= box[3]; y++)
+	{
+		for (x = box[0]; x <= box[2]; x++, i++)
+		{
+			cnr = y * city->x_dim + x;
+			if ((via = tree_via(city, tree, cnr)) == NO_CNR)
+			{
+				vec_push(i, &none);
+			}
+			for (dir = 0; via != NO_CNR && dir < CARD_DIRS; dir++)
+			{
+				if (neighbour(city, cnr, dir) == via)
+				{
+					dirs[i / 4] |= dir << (2 * (i % 4));
+				}
+			}
+			if (i % FIELD_RUN == 0)
+			{
+				/* a run starts from nothing */
+				runs[i / FIELD_RUN] = b - bytes;
+				prev = 0;
+			}
+			cost = tree_cost(city, tree, cnr);
+			delta = cost - prev;
+			prev = cost;
+			zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+			do
+			{
+				*b++ = (zigzag & 0x7f) | (zigzag > 0x7f ? 0x80 : 0);
+				zigzag >>= 7;
+			} while (zigzag);
+		}
+	}
+	head.n_none = none.len;
+	head.n_bytes = runs[head.n_runs] = b - bytes;
+
+	/* now put it all together */
+	field = safe_malloc(field_size(&head));
+	*field = head;
+	if (none.len)
+	{
+		memcpy(field_none(field), none.items, none.len * sizeof(uint32_t));
+	}
+	memcpy(field_runs(field), runs, (head.n_runs + 1) * sizeof(uint32_t));
+	memcpy(field_dirs(field), dirs, (head.n_cnrs + 3) / 4);
+	memcpy(field_bytes(field), bytes, head.n_bytes);
+	clear_vec(&none);
+	free(runs);
+	free(dirs);
+	free(bytes);
+	return field;
+}
+
+/* fill tree with the paths in a field of the whole city */
+void unpack_field(field_t *field, tree_t *tree)
+{
+	uint32_t i;
+
+	tree->states = 1;
+	field_decode(field, 0, field->n_cnrs, tree->cost);
+	for (i = 0; i < field->n_cnrs; i++)
+	{
+		tree->via[i] = field_via(field, i);
+	}
+}
+
+/* the number of bytes in a field block */
+size_t field_size(field_t *field)
+{
+	return sizeof(field_t) + (field->n_none + field->n_runs + 1) *
+		sizeof(uint32_t) + (field->n_cnrs + 3) / 4 + field->n_bytes;
+}
+
+uint32_t* field_none(field_t *field)
+{
+	return (uint32_t*)(field + 1);
+}
+
+uint32_t* field_runs(field_t *field)
+{
+	return field_none(field) + field->n_none;
+}
+
+unsigned char* field_dirs(field_t *field)
+{
+	return (unsigned char*)(field_runs(field) + field->n_runs + 1);
+}
+
+unsigned char* field_bytes(field_t *field)
+{
+	return field_dirs(field) + (field->n_cnrs + 3) / 4;
+}
+
+/* return the index within a field of a corner of the city, which must be
+   in its box */
+uint32_t field_local(field_t *field, uint32_t cnr)
+{
+	return (cnr / field->x_dim - field->box[1]) *
+		(field->box[2] - field->box[0] + 1) + cnr % field->x_dim -
+		field->box[0];
+}
+
+/* return the cost of a corner of the city, decoding only its run */
+int field_cost(field_t *field, uint32_t cnr)
+{
+	int cost;
+	field_decode(field, field_local(field, cnr), 1, &cost);
+	return cost;
+}
+
+/* decode the costs of n corners of a field, from index first within it,
+   into cost */
+void field_decode(field_t *field, uint32_t first, int n, int *cost)
+{
+	int shift, prev = 0;
+	uint32_t i, zigzag;
+	unsigned char *b = field_bytes(field) + field_runs(field)[first / FIELD_RUN];
+
+	for (i = first - first % FIELD_RUN; i < first + n; i++)
+	{
+		if (i % FIELD_RUN == 0)
+		{
+			prev = 0;
+		}
+		zigzag = shift = 0;
+		do
+		{
+			zigzag |= (uint32_t)(*b & 0x7f) << shift;
+			shift += 7;
+		} while (*b++ & 0x80);
+		prev += (int)(zigzag >> 1) ^ -(int)(zigzag & 1);
+		if (i >= first)
+		{
+			cost[i - first] = prev;
+		}
+	}
+}
+
+/* return the via of a corner of the city, or NO_CNR if it has none */
+uint32_t field_via(field_t *field, uint32_t cnr)
+{
+	uint32_t i = field_local(field, cnr);
+
+	if (field->n_none && bsearch(&i, field_none(field), field->n_none,
+		sizeof(uint32_t), cmp_cnr))
+	{
+		return NO_CNR;
+	}
+	return cnr + dir_offset((field_dirs(field)[i / 4] >> (2 * (i % 4))) & 3,
+		field->x_dim);
+}
+
+/* ~PIPE_T FUNCTIONS~ */
+void new_pipe(pipe_t *pipe)
+{
+	atomic_init(&pipe->head, 0);
+	atomic_init(&pipe->tail, 0);
+	atomic_init(&pipe->waiting, 0);
+	if (pthread_mutex_init(&pipe->lock, NULL) ||
+		pthread_cond_init(&pipe->wake, NULL))
+	{
+		exit(EXIT_FAILURE);
+	}
+}
+
+void free_pipe(pipe_t *pipe)
+{
+	pthread_mutex_destroy(&pipe->lock);
+	pthread_cond_destroy(&pipe->wake);
+}
+
+/* push a query onto a pipe, waiting while it is full */
+void pipe_push(pipe_t *pipe, query_t *query)
+{
+	int tries;
+	unsigned long tail = atomic_load_explicit(&pipe->tail,
+		memory_order_relaxed);
+
+	for (tries = 0; tail - atomic_load(&pipe->head) == PIPE_LEN; tries++)
+	{
+		pipe_wait(pipe, &pipe->head, tail - PIPE_LEN, tries);
+	}
+	pipe->items[tail % PIPE_LEN] = query;
+	/* the query is written before the other end can see it */
+	atomic_store(&pipe->tail, tail + 1);
+	pipe_wake(pipe);
+}
+
+/* pop the next query from a pipe, waiting while it is empty */
+query_t* pipe_pop(pipe_t *pipe)
+{
+	int tries;
+	query_t *query;
+	unsigned long head = atomic_load_explicit(&pipe->head,
+		memory_order_relaxed);
+
+	for (tries = 0; head == atomic_load(&pipe->tail); tries++)
+	{
+		pipe_wait(pipe, &pipe->tail, head, tries);
+	}
+	query = pipe->items[head % PIPE_LEN];
+	/* and is read before its slot can be reused */
+	atomic_store(&pipe->head, head + 1);
+	pipe_wake(pipe);
+	return query;
+}
+
+/* wait, the given number of tries in, for the other end of a pipe to move
+   its index on from where it was. the first tries only yield */
+void pipe_wait(pipe_t *pipe, atomic_ulong *index, unsigned long was,
+	int tries)
 {
-	void **items;   /* storage component, an array */
-	int len;		/* number of items in items */
-	size_t size;	/* allocated size of items */
-};
+	if (tries < PIPE_SPINS)
+	{
+		sched_yield();
+		return;
+	}
+	pthread_mutex_lock(&pipe->lock);
+	/* said before looking again, and the other end moves before it looks
+	   at waiting, so one of them sees the other */
+	atomic_fetch_add(&pipe->waiting, 1);
+	while (atomic_load(index) == was)
+	{
+		pthread_cond_wait(&pipe->wake, &pipe->lock);
+	}
+	atomic_fetch_sub(&pipe->waiting, 1);
+	pthread_mutex_unlock(&pipe->lock);
+}
 
-struct queue_t
+/* wake the other end of a pipe, if it is asleep, once this end has moved */
+void pipe_wake(pipe_t *pipe)
 {
-	elem_t *first, *last;
-	size_t len;
-};
+	if (atomic_load(&pipe->waiting))
+	{
+		pthread_mutex_lock(&pipe->lock);
+		pthread_cond_broadcast(&pipe->wake);
+		pthread_mutex_unlock(&pipe->lock);
+	}
+}
 
-struct elem_t
+/* ~HIST_T FUNCTIONS~ */
+/* add a latency, in secs, to a histogram */
+void hist_add(hist_t *hist, double secs)
 {
-	void *data;
-	elem_t *prev, *next;
-};
+	int bucket = 0;
+	double us = secs * 1e6;
 
+	while (bucket < HIST_BUCKETS - 1 && us >= (double)(1L << bucket))
+	{
+		bucket++;
+	}
+	hist->count[bucket]++;
+	hist->n++;
+	hist->total += secs;
+	hist->max = (secs > hist->max) ? secs : hist->max;
+}
 
-/* ~~FUNCTIONS~~ */
-int main(int argc, char *argv[])
+/* print a histogram, by its buckets that aren't empty */
+void print_hist(hist_t *hist, char *name, FILE *fp)
 {
 	int i;
-	node_t *cnr;
-
-	/* read data from stdin */
-	city_t *city = read_city_data();
 
-	print_stage_1(city);
-	print_stage_2(city);
-	print_stage_3(city);
-
-	/* free city memory */
-	for (i = 0; i < city->cnrs->len; i++)
+	fprintf(fp, "P: %-6s %ld queries, mean %.3f ms, max %.3f ms\nP:       ",
+		name, hist->n, hist->n ? 1000.0 * hist->total / hist->n : 0,
+		1000.0 * hist->max);
+	for (i = 0; i < HIST_BUCKETS; i++)
 	{
-		free((cnr = city->cnrs->items[i])->name);
-		clear_list(cnr->out);
-		free(cnr->out);
-		free(cnr);
+		if (hist->count[i])
+		{
+			fprintf(fp, " <%ldus:%ld", 1L << i, hist->count[i]);
+		}
 	}
-	cnr = NULL;
-	clear_list(city->cnrs);
-	free(city->cnrs);
-	clear_list(city->locs);
-	free(city->locs);
-	free(city);
-	city = NULL;
+	fprintf(fp, "\n");
+}
 
-	return 0;
+/* the time, in secs, from a fixed point */
+double now_secs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
 }
 
-void print_stage_1(city_t *city)
+/* ~STATS_T FUNCTIONS~ */
+/* find the statistics of a city's streets, four corners at a time with
+   SSE2 where it is there, else one at a time */
+void city_stats(city_t *city, stats_t *stats)
 {
-	printf("S1: grid is %d x %d, and has %d intersections\n",
-		city->x_dim, city->y_dim, city->cnrs->len);
-	printf("S1: of %d possibilities, %d of them cannot be used\n",
-		CARD_DIRS * city->cnrs->len, city->unusable);
-	printf("S1: total cost of remaining possibilities is %d seconds\n",
-		city->total_secs);
-	printf("S1: %d grid locations supplied",
-		city->locs->len);
-	if (city->locs->len)
-	{
-		printf(", first one is %s, last one is %s",
-			((node_t*)city->locs->items[0])->name,
-			((node_t*)city->locs->items[city->locs->len - 1])->name);
-	}
-	printf("\n\n");
+#ifdef __SSE2__
+	city_stats_sse2(city, stats);
+#else
+	city_stats_scalar(city, stats);
+#endif
 }
 
-void print_stage_2(city_t *city)
+/* start statistics with no streets */
+void clear_stats(stats_t *stats)
 {
-	int i;
-	node_t *cnr;
-	list_t *locs = city->locs;
-	list_t *start = list_insert(locs->items[0], new_list(1), 0);
-	list_t *path = new_list(1);
+	memset(stats, 0, sizeof(stats_t));
+	stats->min = MAX_SECS;
+	stats->max = -1;
+}
 
-	/* find the paths from the first location and each other location */
-	find_paths(city->cnrs, start);
+/* add the streets of a corner to stats, and compare its east and north
+   streets with the other way of each. streets off the grid are left to
+   stats_border */
+void stats_cnr(city_t *city, uint32_t cnr, stats_t *stats)
+{
+	int dir, secs;
+	uint32_t x_d = city->x_dim;
+	edge_t *out = city_cnrs(city)[cnr].out;
 
-	for (i = 1; i < locs->len; i++)
+	for (dir = 0; dir < CARD_DIRS; dir++)
 	{
-		if ((cnr = locs->items[i])->via)
+		if ((secs = out[dir].weight) == MAX_SECS)
 		{
-			/* trace backwards from the end, to the start,
-			   adding the corners to a list */
-			while (cnr->via)
-			{
-				list_insert(cnr, path, -1);
-				cnr = cnr->via;
-			}
-			printf("S2: start at grid %s, cost of %d\n",
-				cnr->name, cnr->cost);
-			while ((cnr = list_remove(-1, path)))
-			{
-				printf("S2:       then to %s, cost of %d\n",
-					cnr->name, cnr->cost);
-			}
+			stats->unusable++;
+			continue;
 		}
+		stats->total_secs += secs;
+		stats->min = (secs < stats->min) ? secs : stats->min;
+		stats->max = (secs > stats->max) ? secs : stats->max;
+		/* times out of range go in the end bins */
+		stats->hist[(secs < 0) ? 0 : (secs / STAT_WIDTH >= STAT_BINS) ?
+			STAT_BINS - 1 : secs / STAT_WIDTH]++;
+	}
+	if (cnr % x_d + 1 < x_d)
+	{
+		stats_pair(out[EAST].weight,
+			city_cnrs(city)[cnr + 1].out[WEST].weight, stats);
+	}
+	if (cnr >= x_d)
+	{
+		stats_pair(out[NORTH].weight,
+			city_cnrs(city)[cnr - x_d].out[SOUTH].weight, stats);
 	}
-	clear_list(start);
-	free(start);
-	start = NULL;
-	clear_list(path);
-	free(path);
-	path = NULL;
 }
 
-void print_stage_3(city_t *city)
+/* compare the times of the two ways along a street */
+void stats_pair(int there, int back, stats_t *stats)
 {
-	int x, y, index, x_d = city->x_dim, y_d = city->y_dim, i;
-	node_t *cnr, *cnr_2;
-	list_t *cnrs = city->cnrs;
-
-	/* find the shortest route to each corner via one of the locations */
-	find_paths(cnrs, city->locs);
-
-	printf("\nS3:");
-	for (i = 0; i < x_d; i++)
+	if ((there == MAX_SECS) != (back == MAX_SECS))
 	{
-		printf("%9d", i);
+		stats->one_way++;
 	}
-	printf("\nS3:   %s", BORDER_CNR);
-	for (i = 0; i < x_d - 1; i++)
+	else if (there != back)
 	{
-		printf(BORDER_TOP);
+		stats->uneven++;
+	}
+}
+
+/* count the usable streets that leave the grid */
+void stats_border(city_t *city, stats_t *stats)
+{
+	int x, y, x_d = city->x_dim, y_d = city->y_dim;
+	node_t *cnrs = city_cnrs(city);
+
+	for (x = 0; x < x_d; x++)
+	{
+		stats->off_grid += (cnrs[x].out[NORTH].weight != MAX_SECS) +
+			(cnrs[(y_d - 1) * x_d + x].out[SOUTH].weight != MAX_SECS);
 	}
 	for (y = 0; y < y_d; y++)
 	{
-		printf("\nS3: %c%s", y + 'a', BORDER_SIDE);
-		for (x = 0; x < x_d; x++)
-		{
-			/* print the arrow to/from the west */
-			cnr = cnrs->items[(index = y * x_d + x)];
-			/* check there is a corner to the west */
-			if (x > 0)
-			{
-				cnr_2 = cnrs->items[index + dir_offset(WEST, x_d)];
-				printf(cnr_2->via == cnr ? ARROW_WEST :
-				       cnr->via == cnr_2 ? ARROW_EAST :
-				                           BLANK_LAT);
-			}
-			printf("%4d", cnr->cost);
-		}
-		for (i = 0; y + 1 != y_d && i < LON_LEN; i++)
-		{
-			printf("\nS3:  %s", BORDER_SIDE);
-			for (x = 0; x < x_d; x++)
-			{
-				/* print the arrow to/from the south */
-				cnr = cnrs->items[(index = y * x_d + x)];
-				/* check there is a corner to the south */
-				if (index + x_d < x_d * y_d)
-				{
-					cnr_2 = cnrs->items[index + dir_offset(SOUTH, x_d)];
-					printf(cnr_2->via == cnr ? ARROW_SOUTH :
-						   cnr->via == cnr_2 ? ARROW_NORTH :
-						                       BLANK_LON);
-				}
-				if (x < x_d - 1)
-				{
-					printf(BLANK_LAT);
-				}
-			}
-		}
+		stats->off_grid += (cnrs[y * x_d].out[WEST].weight != MAX_SECS) +
+			(cnrs[y * x_d + x_d - 1].out[EAST].weight != MAX_SECS);
 	}
-	printf("\n\n");
 }
 
-/* read from stdin: x_dim y_dim [corner name [4 travel times]] [locations],
-   and use this to build our city. it is assumed to be valid data */
-city_t* read_city_data()
+/* city_stats, one corner at a time */
+void city_stats_scalar(city_t *city, stats_t *stats)
 {
-	int index, i, dir, secs, x_d, y_d, count = 0;
-	node_t *cnr;
-	edge_t *st;
-	city_t *city = safe_malloc(sizeof(city_t));
+	uint32_t i;
 
-	/* read the city dimensions */
-	if (scanf(" %d %d", &x_d, &y_d) != 2)
+	clear_stats(stats);
+	for (i = 0; i < city->n_cnrs; i++)
 	{
-		exit(EXIT_FAILURE);
+		stats_cnr(city, i, stats);
 	}
-	city->x_dim = x_d;
-	city->y_dim = y_d;
+	stats_border(city, stats);
+}
 
-	/* maximum length of a corner name */
-	char tmp[(int)ceil(log10(x_d + 1) + 3)];
+#ifdef __SSE2__
+/* load the times of four corners from cnr, as vectors of their east,
+   north, west and south streets. each corner is two vectors of to and
+   weight pairs, so this is a transpose of their weights */
+void load_times(node_t *cnr, __m128i *times)
+{
+	int i;
+	__m128i w[2 * 4];
 
-	/* initialise the city */
-	list_t *cnrs = city->cnrs = new_list(x_d * y_d);
-	list_t *locs = city->locs = new_list(1);
-	for (i = 0; i < x_d * y_d; i++)
+	for (i = 0; i < 2 * 4; i++)
 	{
-		cnr = safe_malloc(sizeof(node_t));
-		cnr->out = new_list(CARD_DIRS);
-		cnr->via = NULL;
-		cnr->cost = 0;
-		list_insert(cnr, cnrs, -1);
+		/* to, weight, to, weight -> weight, weight, weight, weight */
+		w[i] = _mm_shuffle_epi32(_mm_loadu_si128((__m128i*)cnr[i / 2].out +
+			i % 2), _MM_SHUFFLE(3, 1, 3, 1));
 	}
-	city->total_secs = city->unusable = 0;
+	for (i = 0; i < 2; i++)
+	{
+		/* east or west, then north or south, of the four corners */
+		times[i * 2] = _mm_unpacklo_epi64(_mm_unpacklo_epi32(w[i], w[2 + i]),
+			_mm_unpacklo_epi32(w[4 + i], w[6 + i]));
+		times[i * 2 + 1] = _mm_unpackhi_epi64(
+			_mm_unpacklo_epi32(w[i], w[2 + i]),
+			_mm_unpacklo_epi32(w[4 + i], w[6 + i]));
+	}
+}
 
-	/* read data for corner, street travel times and taxi locations */
-	while (scanf(" %s", tmp) > 0)
+/* add to the counts of one way and uneven streets, by lane, for the times
+   of the two ways along four streets */
+void pairs_sse2(__m128i there, __m128i back, __m128i unusable,
+	__m128i *one_way, __m128i *uneven)
+{
+	__m128i there_no = _mm_cmpeq_epi32(there, unusable);
+	__m128i back_no = _mm_cmpeq_epi32(back, unusable);
+	__m128i one = _mm_xor_si128(there_no, back_no);
+	__m128i same = _mm_cmpeq_epi32(there, back);
+
+	/* masks are -1, so subtracting them counts */
+	*one_way = _mm_sub_epi32(*one_way, one);
+	*uneven = _mm_sub_epi32(*uneven, _mm_andnot_si128(_mm_or_si128(one, same),
+		_mm_set1_epi32(-1)));
+}
+
+/* city_stats, four corners of a row at a time. SSE2 has no 32 bit min or
+   max, so they are made from a compare. counts are kept by lane, and added
+   up every STAT_BLOCK steps, before the total time can overflow */
+void city_stats_sse2(city_t *city, stats_t *stats)
+{
+	int i, k, x, y, x_d = city->x_dim, lanes[4], steps = 0;
+	uint32_t cnr;
+	long below_n[STAT_BINS] = {0};
+	node_t *cnrs = city_cnrs(city);
+	__m128i t[CARD_DIRS], above[CARD_DIRS], no, usable, gt, back;
+	__m128i unusable = _mm_set1_epi32(MAX_SECS), tops[STAT_BINS - 1];
+	__m128i ones = _mm_set1_epi32(-1);
+	__m128i min = unusable, max = ones;
+	/* counts: unusable, total time, one way, uneven, then the number of
+	   usable times below the top of each bin, the last being all of them */
+	__m128i n[STAT_COUNTS + STAT_BINS];
+
+	clear_stats(stats);
+	for (k = 0; k < STAT_BINS - 1; k++)
 	{
-		/* index : x-value + y-value * x-dimension */
-		index = atoi(tmp) + (tmp[strlen(tmp) - 1] - 'a') * x_d;
-		if (count++ < x_d * y_d)
+		tops[k] = _mm_set1_epi32((k + 1) * STAT_WIDTH);
+	}
+	for (k = 0; k < STAT_COUNTS + STAT_BINS; k++)
+	{
+		n[k] = _mm_setzero_si128();
+	}
+	for (y = 0; y < city->y_dim; y++)
+	{
+		for (x = 0; x + 4 <= x_d; x += 4)
 		{
-			cnr = cnrs->items[index];
-			cnr->name = safe_malloc((strlen(tmp) + 1) * sizeof(char));
-			strcpy(cnr->name, tmp);
-			/* integer component of name */
-			cnr->x = atoi(cnr->name);
-			/* alphabetic component of name */
-			cnr->y = (int)(cnr->name[strlen(cnr->name) - 1] - 'a');
-
-			/* read street times */
-			for (dir = 0; dir < CARD_DIRS; dir++)
+			cnr = y * x_d + x;
+			load_times(cnrs + cnr, t);
+			for (i = 0; i < CARD_DIRS; i++)
 			{
-				if (scanf(" %d" , &secs) < 0)
-				{
-					/* no value read */
-					exit(EXIT_FAILURE);
-				}
-				if (secs == MAX_SECS)
-				{
-					/* street is unusable */
-					city->unusable++;
-				}
-				else
+				/* masks are -1, so subtracting them counts */
+				no = _mm_cmpeq_epi32(t[i], unusable);
+				usable = _mm_andnot_si128(no, t[i]);
+				n[0] = _mm_sub_epi32(n[0], no);
+				n[1] = _mm_add_epi32(n[1], usable);
+				/* unusable times are MAX_SECS, above any usable one */
+				gt = _mm_cmpgt_epi32(min, t[i]);
+				min = _mm_or_si128(_mm_and_si128(gt, t[i]),
+					_mm_andnot_si128(gt, min));
+				/* and -1 for the max */
+				usable = _mm_or_si128(usable, no);
+				gt = _mm_cmpgt_epi32(usable, max);
+				max = _mm_or_si128(_mm_and_si128(gt, usable),
+					_mm_andnot_si128(gt, max));
+				for (k = 0; k < STAT_BINS - 1; k++)
 				{
-					/* we have a valid street */
-					st = safe_malloc(sizeof(edge_t));
-					city->total_secs += (st->weight = secs);
-					/* corner in the current dir, by index */
-					st->to = cnrs->items[index + dir_offset(dir, x_d)];
-					st->from = cnr;
-					list_insert(st, cnr->out, -1);
+					n[STAT_COUNTS + k] = _mm_sub_epi32(n[STAT_COUNTS + k],
+						_mm_cmplt_epi32(t[i], tops[k]));
 				}
+				n[STAT_COUNTS + k] = _mm_sub_epi32(n[STAT_COUNTS + k],
+					_mm_andnot_si128(no, ones));
+			}
+			/* the west times of the next four corners. the last corner of
+			   a row has no street east, so is made to match itself */
+			back = _mm_or_si128(_mm_srli_si128(t[WEST], 4),
+				_mm_slli_si128(_mm_cvtsi32_si128((x + 4 < x_d) ?
+				cnrs[cnr + 4].out[WEST].weight :
+				cnrs[cnr + 3].out[EAST].weight), 12));
+			pairs_sse2(t[EAST], back, unusable, &n[2], &n[3]);
+			if (y)
+			{
+				load_times(cnrs + cnr - x_d, above);
+				pairs_sse2(t[NORTH], above[SOUTH], unusable, &n[2], &n[3]);
+			}
+			if (++steps == STAT_BLOCK)
+			{
+				stats_lanes(n, stats, below_n);
+				steps = 0;
 			}
 		}
-		else
+		/* the rest of the row */
+		for (; x < x_d; x++)
 		{
-			/* read all of the corner data, now onto the taxis */
-			list_insert(cnrs->items[index], locs, -1);
+			stats_cnr(city, y * x_d + x, stats);
 		}
 	}
-	return city;
+	stats_lanes(n, stats, below_n);
+
+	for (k = 0; k < STAT_BINS; k++)
+	{
+		stats->hist[k] += below_n[k] - (k ? below_n[k - 1] : 0);
+	}
+	_mm_storeu_si128((__m128i*)lanes, min);
+	for (i = 0; i < 4; i++)
+	{
+		stats->min = (lanes[i] < stats->min) ? lanes[i] : stats->min;
+	}
+	_mm_storeu_si128((__m128i*)lanes, max);
+	for (i = 0; i < 4; i++)
+	{
+		stats->max = (lanes[i] > stats->max) ? lanes[i] : stats->max;
+	}
+	stats_border(city, stats);
 }
 
-/* return the index offset in a given dirention */
-int dir_offset(int dir, int x_dim)
+/* add up the lanes of the counts of city_stats_sse2, and clear them */
+void stats_lanes(__m128i *n, stats_t *stats, long *below_n)
 {
-	return (dir == EAST) ? 1 :
-		   (dir == NORTH)? - x_dim :
-		   (dir == WEST) ? - 1 :
-						   x_dim;
+	int k, lanes[4];
+	long sum[STAT_COUNTS + STAT_BINS];
+
+	for (k = 0; k < STAT_COUNTS + STAT_BINS; k++)
+	{
+		_mm_storeu_si128((__m128i*)lanes, n[k]);
+		sum[k] = (long)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+		n[k] = _mm_setzero_si128();
+	}
+	stats->unusable += sum[0];
+	stats->total_secs += sum[1];
+	stats->one_way += sum[2];
+	stats->uneven += sum[3];
+	for (k = 0; k < STAT_BINS; k++)
+	{
+		below_n[k] += sum[STAT_COUNTS + k];
+	}
 }
+#endif
 
-/* find the shortest paths to all nodes from any start.
-   this is a version of Dijkstra's algorithm (1956), modified to allow for
-   multiple starting nodes */
-void find_paths(list_t *nodes, list_t *starts)
+/* print the statistics of a city's streets, and whether they match its
+   totals, which stage 1 prints */
+void print_stats(city_t *city, stats_t *stats, FILE *fp)
 {
-	int i, new_cost, x, y;
-	node_t *cur_node, *node;
-	edge_t *edge;
-	queue_t *to_check = new_queue();
+	int k;
 
-	/* initialise node data */
-	for (i = 0; i < nodes->len; i++)
+	fprintf(fp, "V: %ld streets can be used, %ld can't, %ld seconds in all",
+		CARD_DIRS * (long)city->n_cnrs - stats->unusable, stats->unusable,
+		stats->total_secs);
+	if (stats->max >= 0)
 	{
-		(node = nodes->items[i])->via = NULL;
-		node->cost = MAX_SECS;
+		fprintf(fp, ", from %d to %d seconds", stats->min, stats->max);
 	}
-	for (i = 0; i < starts->len; i++)
+	fprintf(fp, "\nV: seconds");
+	for (k = 0; k < STAT_BINS; k++)
 	{
-		(node = starts->items[i])->cost = 0;
-		enqueue(node, to_check);
+		fprintf(fp, " %d-%d: %ld%s", k * STAT_WIDTH, (k + 1 < STAT_BINS) ?
+			(k + 1) * STAT_WIDTH - 1 : MAX_SECS - 1, stats->hist[k],
+			(k + 1 < STAT_BINS) ? "," : "\n");
 	}
-	
-	while ((cur_node = dequeue(to_check)))
+	fprintf(fp, "V: %ld one way streets, %ld two way streets with different "
+		"times each way, %ld usable streets off the grid\n", stats->one_way,
+		stats->uneven, stats->off_grid);
+	if (stats->total_secs != city->total_secs ||
+		stats->unusable != city->unusable)
 	{
-		x = cur_node->x;
-		y = cur_node->y;
-		/* check each outgoing edge */
-		for (i = 0; i < cur_node->out->len; i++)
+		fprintf(fp, "V: the city's totals, %d seconds and %d unusable, "
+			"don't match\n", city->total_secs, city->unusable);
+	}
+}
+
+/* ~TRAFFIC_T FUNCTIONS~ */
+/* read the traffic model named in opts, or return NULL if there is none.
+   a turns file has lines of: corner arrived_dir left_dir secs, with the
+   directions as one of DIR_CHARS, eg. "3b E N 12" for a left turn at 3b.
+   a profile file has lines of: start_secs percentage, one per period of the
+   day, ascending. the last period carries on past midnight */
+traffic_t* read_traffic(city_t *city, opts_t *opts)
+{
+	int i, secs, pct, in, out;
+	char tmp[NAME_LEN], in_c, out_c;
+	FILE *fp;
+	traffic_t *traffic;
+
+	if (!opts->turns_file && !opts->profile_file)
+	{
+		return NULL;
+	}
+	traffic = safe_malloc(sizeof(traffic_t));
+	traffic->turns = NULL;
+	traffic->n_periods = 0;
+	traffic->start = traffic->pct = NULL;
+	traffic->depart = opts->depart;
+
+	if (opts->turns_file)
+	{
+		if (!(fp = fopen(opts->turns_file, "r")))
+		{
+			perror(opts->turns_file);
+			exit(EXIT_FAILURE);
+		}
+		traffic->turns = safe_malloc(city->n_cnrs * CARD_DIRS * CARD_DIRS
+			* sizeof(short));
+		memset(traffic->turns, 0, city->n_cnrs * CARD_DIRS * CARD_DIRS
+			* sizeof(short));
+		while (fscanf(fp, " %15s %c %c %d", tmp, &in_c, &out_c, &secs) == 4)
 		{
-			edge = cur_node->out->items[i];
-			node = edge->to;
-			new_cost = cur_node->cost + edge->weight;
-			/* lower cost path to node */
-			if (new_cost < node->cost)
+			i = atoi(tmp) + (tmp[strlen(tmp) - 1] - 'a') * city->x_dim;
+			if (!strchr(DIR_CHARS, in_c) || !strchr(DIR_CHARS, out_c) ||
+				i < 0 || (uint32_t)i >= city->n_cnrs || secs < 0 ||
+				secs >= MAX_SECS)
 			{
-				node->via = cur_node;
-				node->cost = new_cost;
-				enqueue(node, to_check);
+				exit(EXIT_FAILURE);
 			}
-			/* cur_node new_cost is equal and is lexographically lower */
-			else if (new_cost == node->cost && (x < node->via->x || 
-				(x == node->via->x && y < node->via->y)))
+			in = strchr(DIR_CHARS, in_c) - DIR_CHARS;
+			out = strchr(DIR_CHARS, out_c) - DIR_CHARS;
+			traffic->turns[(i * CARD_DIRS + in) * CARD_DIRS + out] = secs;
+		}
+		fclose(fp);
+	}
+
+	if (opts->profile_file)
+	{
+		if (!(fp = fopen(opts->profile_file, "r")))
+		{
+			perror(opts->profile_file);
+			exit(EXIT_FAILURE);
+		}
+		while (fscanf(fp, " %d %d", &secs, &pct) == 2)
+		{
+			if (secs < 0 || secs >= DAY_SECS || pct < 0 || (traffic->n_periods
+				&& secs <= traffic->start[traffic->n_periods - 1]))
 			{
-				node->via = cur_node;
+				exit(EXIT_FAILURE);
 			}
+			i = traffic->n_periods++;
+			traffic->start = safe_realloc(traffic->start,
+				traffic->n_periods * sizeof(int));
+			traffic->pct = safe_realloc(traffic->pct,
+				traffic->n_periods * sizeof(int));
+			traffic->start[i] = secs;
+			traffic->pct[i] = pct;
 		}
+		fclose(fp);
 	}
-	clear_queue(to_check);
-	free(to_check);
-	to_check = NULL;
+	return traffic;
 }
 
-/* ~LIST_T FUNCTIONS~ */
-/* malloc and return a pointer to an list_t with preallocated space */
-list_t* new_list(size_t size)
+void free_traffic(traffic_t *traffic)
 {
-	list_t *list = safe_malloc(sizeof(list_t));
-	list->size = (size > 0) ? size : 1;
-	list->items = safe_malloc(list->size * sizeof(void*));
-	list->len = 0;
-	return list;
+	free(traffic->turns);
+	free(traffic->start);
+	free(traffic->pct);
+	free(traffic);
 }
 
-/* insert item into the list maintaining order, and return a pointer to
-   the list_t.
-   if the index is out of the bounds of the list, insert at the end */
-list_t* list_insert(void *item, list_t *list, int index)
+/* secs to turn at cnr from arriving in dir in to leaving in dir out */
+int turn_secs(traffic_t *traffic, uint32_t cnr, int in, int out)
 {
-	int i = list->len++;
-	if (list->len >= list->size)
-	{
-		list->size = (list->size > 0) ? ceil(list->size * GROWTH_MUL) : 1;
-		list->items = safe_realloc(list->items, list->size * sizeof(void*));
-	}
-	if (index >= 0 && index < list->len)
-	{
-		/* shift items up to make space for the new item */
-		while (i > index + 1)
-		{
-			list->items[i] = list->items[i - 1];
-			i--;
-		}
-	}
-	list->items[i] = item;
-	return list;
+	return (in == HALT || !traffic->turns) ? 0 :
+		traffic->turns[(cnr * CARD_DIRS + in) * CARD_DIRS + out];
 }
 
-/* remove the indexth item from list, then return that item.
-   if index is -1, return the last item,
-   else if index is out of the bounds of the list, return NULL */
-void* list_remove(int index, list_t *list)
+/* secs to travel a street of the given weight, reached elapsed secs after
+   departing. a taxi may wait for a quicker period, so leaving later never
+   arrives sooner, which keeps checking states in order of cost exact */
+int street_secs(traffic_t *traffic, int weight, int elapsed)
 {
-	if (list->len == 0 || index < -1 || index >= list->len)
+	int i, k, wait, secs, best, now, n = traffic->n_periods;
+
+	if (!n)
 	{
-		return NULL;
+		return weight;
+	}
+	now = (traffic->depart + elapsed) % DAY_SECS;
+	/* the period now is in, which is the last one before the first starts */
+	for (k = n - 1; k > 0 && traffic->start[k] > now; k--);
+	if (traffic->start[k] > now)
+	{
+		k = n - 1;
 	}
-	int i = (index == -1) ? list->len - 1 : index;
-	void *item = list->items[i];
-	if (i != list->len - 1)
+	best = weight * traffic->pct[k] / 100;
+	for (i = 1; i < n; i++)
 	{
-		/* fill the void left by the item with the subsequent items */
-		for (i = index; i >= 0 && i < list->len; i++)
+		k = (k + 1) % n;
+		wait = (traffic->start[k] - now + DAY_SECS) % DAY_SECS;
+		if (wait >= best)
 		{
-			list->items[i] = list->items[i + 1];
+			break;
+		}
+		if ((secs = wait + weight * traffic->pct[k] / 100) < best)
+		{
+			best = secs;
 		}
 	}
-	list->items[--list->len] = NULL;
-	return item;
-}
-
-void clear_list(list_t *list)
-{
-	free(list->items);
-	list->items = NULL;
-	list->len = list->size = 0;
+	return best;
 }
 
 /* ~QUEUE_T FUNCTIONS~ */
@@ -472,7 +4722,7 @@ queue_t* new_queue()
 }
 
 /* add an item to the end of a queue, and return a pointer to the queue */
-queue_t* enqueue(void *data, queue_t *q)
+queue_t* enqueue(uint32_t data, queue_t *q)
 {
 	elem_t *new = safe_malloc(sizeof(elem_t));
 	new->data = data;
@@ -491,21 +4741,21 @@ queue_t* enqueue(void *data, queue_t *q)
 	return q;
 }
 
-/* remove and return the data of the first item in a queue. 
-   NULL if queue is empty */
-void* dequeue(queue_t *q)
+/* remove and return the data of the first item in a queue.
+   NO_CNR if queue is empty */
+uint32_t dequeue(queue_t *q)
 {
 	if (!q->len)
 	{
 		/* queue is empty */
-		return NULL;
+		return NO_CNR;
 	}
 	if (!(--q->len))
 	{
 		q->last = NULL;
 	}
 	elem_t *elem = q->first;
-	void *data = elem->data;
+	uint32_t data = elem->data;
 	q->first = elem->next;
 	free(elem);
 	return data;
@@ -525,16 +4775,178 @@ void clear_queue(queue_t *q)
 	q->len = 0;
 }
 
+/* ~VEC_T FUNCTIONS~ */
+/* append a corner index to the end of a vec, growing it if needed */
+void vec_push(uint32_t item, vec_t *vec)
+{
+	if ((size_t)vec->len >= vec->size)
+	{
+		vec->size = (vec->size > 0) ? vec->size * GROWTH_MUL : 1;
+		vec->items = safe_realloc(vec->items, vec->size * sizeof(uint32_t));
+	}
+	vec->items[vec->len++] = item;
+}
+
+void clear_vec(vec_t *vec)
+{
+	free(vec->items);
+	vec->items = NULL;
+	vec->len = vec->size = 0;
+}
+
+/* malloc the BUCKETS empty vecs of dial's queue */
+vec_t* new_buckets()
+{
+	int i;
+	vec_t *buckets = safe_malloc(BUCKETS * sizeof(vec_t));
+
+	for (i = 0; i < BUCKETS; i++)
+	{
+		buckets[i].items = NULL;
+		buckets[i].len = buckets[i].size = 0;
+	}
+	return buckets;
+}
+
+void free_buckets(vec_t *buckets)
+{
+	int i;
+
+	for (i = 0; i < BUCKETS; i++)
+	{
+		clear_vec(&buckets[i]);
+	}
+	free(buckets);
+}
+
+/* ~ELIST_T FUNCTIONS~ */
+/* add a street, or a shortcut through mid, to a list, or if there is
+   already one to the same corner, keep the lower weight of the two */
+void elist_add(uint32_t to, int weight, uint32_t mid, elist_t *list)
+{
+	int i;
+
+	for (i = 0; i < list->len; i++)
+	{
+		if (list->items[i].to == to)
+		{
+			if (weight < list->items[i].weight)
+			{
+				list->items[i].weight = weight;
+				list->mids[i] = mid;
+			}
+			return;
+		}
+	}
+	if ((size_t)list->len >= list->size)
+	{
+		list->size = (list->size > 0) ? list->size * GROWTH_MUL : 1;
+		list->items = safe_realloc(list->items, list->size * sizeof(edge_t));
+		list->mids = safe_realloc(list->mids, list->size * sizeof(uint32_t));
+	}
+	list->items[list->len].to = to;
+	list->items[list->len].weight = weight;
+	list->mids[list->len++] = mid;
+}
+
+/* remove the street to a corner from a list, if there is one */
+void elist_remove(uint32_t to, elist_t *list)
+{
+	int i;
+
+	for (i = 0; i < list->len; i++)
+	{
+		if (list->items[i].to == to)
+		{
+			list->items[i] = list->items[--list->len];
+			list->mids[i] = list->mids[list->len];
+			return;
+		}
+	}
+}
+
+/* ~HEAP_T FUNCTIONS~ */
+/* add an item to a heap with the given key */
+void heap_push(uint32_t item, int key, heap_t *heap)
+{
+	int i = heap->len++, parent;
+
+	if ((size_t)heap->len > heap->size)
+	{
+		heap->size = (heap->size > 0) ? heap->size * GROWTH_MUL : 1;
+		heap->items = safe_realloc(heap->items, heap->size * sizeof(uint32_t));
+		heap->keys = safe_realloc(heap->keys, heap->size * sizeof(int));
+	}
+	/* sift the new item up from the bottom */
+	while (i > 0 && heap->keys[(parent = (i - 1) / 2)] > key)
+	{
+		heap->items[i] = heap->items[parent];
+		heap->keys[i] = heap->keys[parent];
+		i = parent;
+	}
+	heap->items[i] = item;
+	heap->keys[i] = key;
+}
+
+/* remove and return the item with the lowest key from a non-empty heap,
+   putting its key in key */
+uint32_t heap_pop(heap_t *heap, int *key)
+{
+	int i = 0, child, last_key = heap->keys[--heap->len];
+	uint32_t item = heap->items[0], last = heap->items[heap->len];
+
+	*key = heap->keys[0];
+	/* sift the last item down from the top */
+	while ((child = 2 * i + 1) < heap->len)
+	{
+		if (child + 1 < heap->len && heap->keys[child + 1] < heap->keys[child])
+		{
+			child++;
+		}
+		if (heap->keys[child] >= last_key)
+		{
+			break;
+		}
+		heap->items[i] = heap->items[child];
+		heap->keys[i] = heap->keys[child];
+		i = child;
+	}
+	heap->items[i] = last;
+	heap->keys[i] = last_key;
+	return item;
+}
+
+/* ~TREE_T FUNCTIONS~ */
+/* malloc a tree_t with space for the paths to n_cnrs corners, in up to
+   states states each */
+tree_t* new_tree(uint32_t n_cnrs, int states)
+{
+	tree_t *tree = safe_malloc(sizeof(tree_t));
+	tree->via = safe_malloc(n_cnrs * states * sizeof(uint32_t));
+	tree->cost = safe_malloc(n_cnrs * states * sizeof(int));
+	tree->states = states;
+	tree->buckets = new_buckets();
+	return tree;
+}
+
+void free_tree(tree_t *tree)
+{
+	free(tree->via);
+	free(tree->cost);
+	free_buckets(tree->buckets);
+	free(tree);
+}
+
 /* ~MEMORY ALLOCATION FUNCTIONS~ */
 /* malloc, check we got a pointer allocated, and return the new pointer */
 void* safe_malloc(size_t size)
 {
-	void *ptr = malloc(size * sizeof(void*));
+	void *ptr = malloc(size);
 	assert(ptr);
 	return ptr;
 }
 
-/* realloc, check we got a pointer allocated, and return the new pointer */   
+/* realloc, check we got a pointer allocated, and return the new pointer */
 void* safe_realloc(void *ptr, size_t size)
 {
 	assert((ptr = realloc(ptr, size)));